@@ -26,6 +26,8 @@ namespace barock {
   struct wl_seat_t;
   struct wl_data_device_manager_t;
   struct wl_output_t;
+  struct wp_presentation_t;
+  struct wp_tearing_control_t;
   struct hotkey_t;
 
   // Forward declaratios
@@ -49,6 +51,9 @@ namespace barock {
     std::unique_ptr<xdg_shell_t>              xdg_shell;
     std::unique_ptr<wl_seat_t>                seat;
     std::unique_ptr<wl_output_t>              wl_output;
+    std::unique_ptr<wp_presentation_t>        wp_presentation;
+    std::unique_ptr<wp_tearing_control_t>     wp_tearing_control;
+    std::unique_ptr<dmabuf_t>                 dmabuf;
     std::unique_ptr<wl_data_device_manager_t> wl_data_device_manager;
     std::unique_ptr<event_bus_t>              event_bus;
   };
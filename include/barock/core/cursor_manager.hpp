@@ -28,12 +28,21 @@ namespace barock {
     output_t *output_;   ///< The output the cursor is on
 
     std::variant<shared_t<surface_t>, XcursorImage *> texture_;
+    bool hardware_; ///< The cursor is on the hardware cursor plane of `output_`
+    jsl::optional_t<signal_token_t>
+      buffer_token_; ///< Token for `on_buffer_attach` of the cursor surface
 
     // Focus management
     weak_t<surface_t> focus_;
 
     jsl::optional_t<signal_token_t>
       paint_token_; ///< Token for the `on_repaint` handler on the current `output_`
+    jsl::optional_t<signal_token_t>
+      present_token_; ///< Token for the `on_present` handler on the current `output_`
+    jsl::optional_t<signal_token_t>
+      scanout_token_; ///< Token for the `on_scanout` handler on the current `output_`
+    jsl::optional_t<signal_token_t>
+      overlay_token_; ///< Token for the `on_overlay` handler on the current `output_`
 
     service_registry_t &registry_;
 
@@ -51,6 +60,37 @@ namespace barock {
     signal_action_t
     paint(output_t &);
 
+    signal_action_t
+    scanout(output_t &, surface_t *&candidate);
+
+    signal_action_t
+    overlay(output_t &, std::vector<plane_assignment_t> &candidates);
+
+    signal_action_t
+    present(output_t &, const presentation_t &presentation);
+
+    /**
+     * @brief Damage the area the cursor currently covers on its
+     * output.  Called before and after anything that changes where or
+     * how the cursor is drawn.
+     */
+    void
+    damage() const;
+
+    /**
+     * @brief Try to put the cursor image onto the hardware cursor
+     * plane of its output, and fall back to drawing it on every repaint
+     * if that fails.
+     */
+    void
+    upload();
+
+    /**
+     * @brief Top left corner of the cursor image, in screenspace.
+     */
+    ipoint_t
+    top_left() const;
+
     public:
     static constexpr size_t CURSOR_PAINT_LAYER = std::numeric_limits<size_t>::max();
 
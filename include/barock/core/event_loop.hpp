@@ -1,6 +1,9 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <cstdint>
@@ -14,11 +17,35 @@ namespace barock {
     wl_event_loop                                                                   *event_loop_;
     std::vector<std::unique_ptr<wl_event_source, decltype(&wl_event_source_remove)>> sources_;
 
+    std::thread::id                    thread_;   ///< The thread that dispatches the loop
+    int                                wakeup_;   ///< eventfd, signalled when `deferred_' fills
+    std::mutex                         mutex_;    ///< Guards `deferred_'
+    std::vector<std::function<void()>> deferred_; ///< Work other threads left for the loop
+
+    static int
+    run_deferred(int32_t, uint32_t, void *);
+
     public:
     event_loop_t(wl_event_loop *ev);
+    ~event_loop_t();
 
     void
     add_fd(int fd, uint32_t mask, int (*func)(int32_t, uint32_t, void *), void *ud);
+
+    /**
+     * @brief Add a timer, it is disarmed until it is set with
+     * `wl_event_source_timer_update'.
+     */
+    wl_event_source *
+    add_timer(int (*func)(void *), void *ud);
+
+    /**
+     * @brief Run `fn' on the thread that dispatches the loop, right
+     * away if that is the calling one.  libwayland-server isn't thread
+     * safe, render threads hand anything that talks to clients over.
+     */
+    void
+    defer(std::function<void()> fn);
   };
 
 }
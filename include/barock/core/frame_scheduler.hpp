@@ -0,0 +1,96 @@
+#pragma once
+
+#include "barock/core/kms.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+namespace barock {
+
+  /**
+   * @brief Decides when an output paints, and paces the display when
+   * nothing changes.  Without VRR frames start as late as they can and
+   * still make the next vblank.  Under VRR a fullscreen client sets the
+   * pace on its own, anything else ramps the refresh rate down with
+   * repeats once it stops updating, panels flicker when the rate drops
+   * all at once.
+   *
+   * Everything but `presented' belongs to the render thread of the
+   * output, times are in microseconds (CLOCK_MONOTONIC).
+   */
+  class frame_scheduler_t {
+    public:
+    static constexpr uint32_t PAINT_MARGIN_USEC = 1500;  ///< Slack on top of the paint time
+    static constexpr uint32_t VRR_RAMP_STEPS    = 8;     ///< Repeats down from the mode's rate
+    static constexpr uint32_t VRR_RAMP_MAX_USEC = 33333; ///< Interval of the last repeat
+
+    frame_scheduler_t();
+
+    /**
+     * @brief How long an idle output waits for the next repeat of the
+     * VRR ramp, 0 if there is none and it waits for damage only.
+     */
+    uint64_t
+    timeout() const;
+
+    /// The wait for damage hit `timeout', a repeat is due
+    void
+    idle();
+
+    /// Whether a repeat is due, and take it
+    bool
+    take_repeat();
+
+    /**
+     * @brief The latest time to start painting and still make the
+     * first vblank we can, after those the frames in flight wait for.
+     * `now' if there is no vblank to wait for.
+     */
+    uint64_t
+    start(uint64_t now, float rate) const;
+
+    /**
+     * @brief Set up the pacing of the frame about to be painted.  `vrr'
+     * is what the user wants, `kms' may not support it.  `fullscreen'
+     * is whether a client covers the output, `async' whether it tears.
+     * Returns whether VRR is on.
+     */
+    bool
+    frame(kms_t &kms, bool vrr, bool fullscreen, bool async, float rate);
+
+    /**
+     * @brief Repeat the frame on screen, the next step of the ramp.
+     * Returns false and stops the ramp if `kms' can't.
+     */
+    bool
+    repeat(kms_t &kms, present_handler_t on_presented);
+
+    /// A frame was handed to the display, its flip is pending
+    void
+    flipping();
+
+    /// Handing the frame to the display failed after all
+    void
+    dropped();
+
+    /// The flip of a frame landed, called from the thread that reads the flip events
+    void
+    presented(const presentation_t &presentation);
+
+    /// A frame took `usec' to paint
+    void
+    painted(uint64_t usec);
+
+    private:
+    std::atomic<uint64_t> last_vblank_; ///< When the last frame reached the screen, 0 if never
+    std::atomic<int>      in_flight_;   ///< Frames that are waiting for their vblank
+    float                 paint_usec_;  ///< Smoothed time painting takes
+
+    bool     async_;     ///< The last frame was flipped without waiting for vblank
+    bool     follow_;    ///< A fullscreen client drives the refresh rate under VRR
+    float    ramp_usec_; ///< Interval until the next repeat of the ramp, 0 if none
+    float    ramp_step_; ///< Growth of `ramp_usec_' per repeat
+    uint32_t ramp_left_; ///< Repeats left in the ramp
+    bool     ramp_due_;  ///< The next repeat is due
+  };
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+namespace barock {
+
+  /**
+   * @brief When and how a committed frame reached the screen.
+   */
+  struct presentation_t {
+    uint64_t usec;                   ///< Time scanout of the frame started (CLOCK_MONOTONIC)
+    uint32_t sequence;               ///< Vertical retrace counter of the output, 0 if none
+    uint32_t refresh;                ///< Nanoseconds until the next refresh, 0 if unknown
+    uint32_t flags;                  ///< `wp_presentation_feedback' kind flags
+    uint64_t frame     = UINT64_MAX; ///< Newest frame this completes, see `output_t::painting'
+    bool     discarded = false;      ///< The frame was dropped and never reached the screen
+
+    uint32_t
+    msec() const {
+      return usec / 1000;
+    }
+  };
+
+  using present_handler_t = std::function<void(const presentation_t &)>;
+
+  /**
+   * @brief The part of the display that paces frames, what
+   * `frame_scheduler_t' drives.  Renderers implement it on top of
+   * KMS, the tests with a fake display.
+   */
+  class kms_t {
+    public:
+    virtual ~kms_t() = default;
+
+    /**
+     * @brief Let the refresh rate of the display follow our commits
+     * (adaptive sync), from the next flip on.  Returns false if the
+     * display can't do that.
+     */
+    virtual bool
+    vrr(bool enable) = 0;
+
+    /**
+     * @brief Flip to what is on screen already, without compositing
+     * anything.  With VRR this starts a refresh cycle when we want it
+     * to.  `on_presented' is called once the flip landed.  Returns
+     * false if that isn't possible.
+     */
+    virtual bool
+    repeat(present_handler_t on_presented) = 0;
+  };
+}
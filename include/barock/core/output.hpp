@@ -1,16 +1,20 @@
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "barock/core/animation.hpp"
+#include "barock/core/frame_scheduler.hpp"
 #include "barock/core/metadata.hpp"
 #include "barock/core/point.hpp"
-#include "barock/core/quad_tree.hpp"
+#include "barock/core/region.hpp"
+#include "barock/core/renderer.hpp"
 #include "barock/core/signal.hpp"
 #include "barock/core/surface.hpp"
 
@@ -65,9 +69,10 @@ namespace barock {
   }
 
   struct mode_set_allocator_t {
-    uint32_t                                taken_;
-    minidrm::drm::handle_t                  handle_;
-    std::unordered_map<std::string, size_t> plan_;
+    uint32_t                                  taken_;
+    minidrm::drm::handle_t                    handle_;
+    std::unordered_map<std::string, size_t>   plan_;
+    std::unordered_map<std::string, uint32_t> possible_; ///< CRTC mask the connector can drive
 
     public:
     mode_set_allocator_t(minidrm::drm::handle_t);
@@ -76,19 +81,70 @@ namespace barock {
     adopt(const minidrm::drm::connector_t &connector);
 
     minidrm::framebuffer::egl_t
-    mode_set(const minidrm::drm::connector_t &connector, const minidrm::drm::mode_t &mode);
+    mode_set(const minidrm::drm::connector_t &connector,
+             const minidrm::drm::mode_t      &mode,
+             uint32_t                         backbuffers);
+  };
+
+  /**
+   * @brief How often and how much a surface updates, what overlay
+   * planes are assigned by.
+   */
+  struct plane_stats_t {
+    uint32_t last_commit = 0;      ///< Time of the last commit, in msec
+    float    interval    = 1000.f; ///< Smoothed msec between commits
+    float    coverage    = 0.f;    ///< Smoothed fraction of the surface damaged per commit
   };
 
   struct output_t {
     private:
     friend class output_manager_t;
 
-    mutable quad_tree_t<int, void *>
-      damage_; ///< Damage tracking on this output, note that this tree is in screenspace
-               ///< coordinates, not workspace!
+    static constexpr float    PLANE_SCORE_MIN = 0.5f; ///< Below this, a surface stays composited
+    static constexpr uint32_t PLANE_IDLE_MSEC = 500; ///< Surfaces that stopped updating lose their plane
+
+    static constexpr size_t MAX_DAMAGE_RECTS = 16; ///< Above this, damage collapses into one rect
+    static constexpr size_t MAX_BUFFER_AGE   = 4;  ///< Frames of damage history we keep
+
+    mutable std::vector<region_t>
+      damage_; ///< Damage tracking on this output, note that these rects are in screenspace
+               ///< coordinates, not workspace! They never overlap each other.
+    std::vector<region_t> repaint_; ///< Region that is being redrawn in the current frame
+    std::array<std::vector<region_t>, MAX_BUFFER_AGE>
+           history_;      ///< Ring of the damage of the last frames, used with the buffer age
+    size_t history_head_; ///< Index of the most recent frame in `history_'
+    size_t history_size_; ///< Number of valid frames in `history_'
     mutable std::recursive_mutex        dirty_;
     mutable std::condition_variable_any dirty_cv_;
     mutable std::atomic_bool            force_render_;
+    bool scanout_; ///< The last frame was scanned out, our backbuffers are stale
+    std::atomic_bool tearing_; ///< Fullscreen clients may ask for flips that don't wait for vblank
+    std::atomic_bool vrr_;     ///< The refresh rate may follow our frames (adaptive sync)
+    uint32_t backbuffers_; ///< Swapchain depth, applied with the next mode set
+
+    frame_scheduler_t scheduler_; ///< When to paint, and the VRR ramp
+    uint64_t          frames_;    ///< Frames painted so far, they are numbered by it
+
+    std::vector<plane_assignment_t> planes_; ///< Surfaces on overlay planes
+    mutable bool planes_dirty_;    ///< A surface on an overlay plane committed a new buffer
+    mutable bool frame_requested_; ///< A surface asked for a frame, but damaged nothing
+    mutable std::unordered_map<const surface_t *, plane_stats_t>
+      stats_; ///< Update statistics of the surfaces on this output
+
+    /**
+     * @brief Score the `candidates' and put the best ones on overlay
+     * planes, as far as the display engine accepts them.  Returns the
+     * surfaces that ended up on a plane.
+     */
+    std::vector<plane_assignment_t>
+    assign_planes(std::vector<plane_assignment_t> candidates);
+
+    /**
+     * @brief Whether there is anything to paint, call with `dirty'
+     * locked.
+     */
+    bool
+    pending() const;
     // mat4x4 transform;
 
     animation_t<fpoint_t> pan_;  ///< Pan
@@ -107,6 +163,14 @@ namespace barock {
 
     struct {
       std::map<size_t, signal_t<output_t &>> on_repaint;
+      std::map<size_t, signal_t<output_t &, surface_t *&>>
+        on_scanout; ///< Pick a surface to scan out instead of compositing, in the same layers
+                    ///< as `on_repaint'.  Layers may replace or clear the candidate.
+      std::map<size_t, signal_t<output_t &, std::vector<plane_assignment_t> &>>
+        on_overlay; ///< Propose surfaces for overlay planes, in the same layers as
+                    ///< `on_repaint'.  Only unoccluded, opaque surfaces qualify.
+      signal_t<output_t &, const presentation_t &>
+        on_present; ///< A painted frame reached the screen, with its presentation feedback
     } events;
 
     // Generic RTTI data store
@@ -131,11 +195,41 @@ namespace barock {
     void
     force_render() const;
 
+    /**
+     * @brief A surface on this output committed frame callbacks but no
+     * damage.  Those complete with the next frame, so there has to be
+     * one, even though nothing on screen changes.
+     */
+    void
+    frame_requested() const;
+
+    /// A frame of one output
+    struct frame_id_t {
+      const output_t *output; ///< nullptr if none
+      uint64_t        number; ///< Counts up per output, 0 is none
+    };
+
+    /**
+     * @brief The frame the calling render thread paints, or painted
+     * last.  None on other threads.
+     */
+    static frame_id_t
+    painting();
+
     ///! Track some damage on this output
     void
     damage(const region_t &region) const;
 
-    ///! Return whether a point on the output is currently damanged, and thus should be re-rendered.
+    ///! Track a commit of `surface', that damaged `region' (screenspace) on this output.
+    void
+    damage(const surface_t &surface, const region_t &region) const;
+
+    ///! Return whether `surface' is shown on an overlay plane, instead of being composited.
+    bool
+    on_plane(const surface_t &surface) const;
+
+    ///! Return whether a point on the output is damaged in the frame that is currently being
+    ///! painted, and thus should be re-rendered.
     bool
     damaged(const ipoint_t &) const;
 
@@ -219,7 +313,68 @@ namespace barock {
     zoom() const;
 
     /**
-     * @brief Render a frame and swap buffers.
+     * @brief Return whether fullscreen clients are allowed to tear.
+     */
+    bool
+    tearing() const;
+
+    /**
+     * @brief Allow fullscreen clients that hint for it (`wp_tearing_control')
+     * to present without waiting for vblank.  Everything else stays in sync.
+     */
+    void
+    tearing(bool allow);
+
+    /**
+     * @brief Return whether adaptive sync is enabled.
+     */
+    bool
+    vrr() const;
+
+    /**
+     * @brief Let the refresh rate follow our frames, if the display
+     * supports it.  A fullscreen client then gets its frames on screen
+     * as soon as it commits them, and idle outputs ramp their refresh
+     * rate down gradually instead of dropping to the minimum at once.
+     */
+    void
+    vrr(bool enable);
+
+    /**
+     * @brief Return the swapchain depth of this output.
+     */
+    uint32_t
+    backbuffers() const;
+
+    /**
+     * @brief Set the swapchain depth, 2 or 3, for the next mode set.
+     * With 3 the next frame can be painted while the last one still
+     * waits for its flip, which evens out spiky frame times.
+     */
+    void
+    backbuffers(uint32_t count);
+
+    /**
+     * @brief Wait for damage, call with `dirty' locked.  While the
+     * refresh rate is ramping down, this also wakes up once the next
+     * repeat is due.
+     */
+    void
+    wait(std::unique_lock<std::recursive_mutex> &lock);
+
+    /**
+     * @brief Wait until the latest point in time we can start painting
+     * and still make the next vblank.  Call with `dirty' locked, after
+     * being woken up for new damage.  Everything damaged in the
+     * meantime goes into the same frame.
+     */
+    void
+    schedule(std::unique_lock<std::recursive_mutex> &lock);
+
+    /**
+     * @brief Render a frame and swap buffers.  Call with `dirty'
+     * unlocked, this waits for page flips to land, and only the
+     * wayland thread dispatches those.
      */
     void
     paint();
@@ -14,7 +14,7 @@ namespace barock {
 
     template<typename _Conversion>
     point_t<_Conversion>
-    to() {
+    to() const {
       return point_t<_Conversion>{ static_cast<_Conversion>(x), static_cast<_Conversion>(y) };
     };
 
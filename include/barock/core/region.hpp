@@ -12,6 +12,13 @@ namespace barock {
     region_t() = default;
     region_t(int32_t, int32_t, int32_t, int32_t);
 
+    /**
+     * @brief A rectangle from a client, with the position and size kept
+     * small enough for `x + w' and `y + h' not to overflow.
+     */
+    static region_t
+    clamped(int32_t x, int32_t y, int32_t w, int32_t h);
+
     template<typename _Scalar>
     region_t(const point_t<_Scalar> &coords, const point_t<_Scalar> &size)
       : x(coords.x)
@@ -42,6 +49,44 @@ namespace barock {
 
     region_t
     union_with(const region_t &other) const;
+
+    /**
+     * @brief Whether the region covers nothing.  Mind that `infinite'
+     * is empty by this measure, it never takes part in arithmetic.
+     */
+    bool
+    empty() const;
+
+    /**
+     * @brief The largest rectangle that this and `other' cover together.
+     */
+    region_t
+    inner_union(const region_t &other) const;
+
+    /**
+     * @brief The largest rectangle of this, that `other' doesn't cover.
+     */
+    region_t
+    inner_subtract(const region_t &other) const;
+
+    /**
+     * @brief The smallest rectangle that covers what is left of this,
+     * once `other' is taken away.
+     */
+    region_t
+    outer_subtract(const region_t &other) const;
+  };
+
+  /**
+   * @brief What a `wl_region' holds.  A region_t is one rectangle, so
+   * we keep the smallest one covering the region and the largest one
+   * it covers in full.  Input regions take the former, opaque regions
+   * the latter; an opaque region that claims too much skips blending
+   * where it is needed.
+   */
+  struct wl_region_data_t {
+    region_t outer{ 0, 0, 0, 0 }; ///< Covers all of the region
+    region_t inner{ 0, 0, 0, 0 }; ///< Covered by the region in full
   };
 
   // Wayland protocol implementation
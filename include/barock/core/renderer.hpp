@@ -1,12 +1,27 @@
 #pragma once
 
+#include "barock/core/kms.hpp"
 #include "barock/core/point.hpp"
+#include "barock/core/region.hpp"
 #include "barock/core/surface.hpp"
 
+#include <cstdint>
+#include <functional>
+#include <vector>
+
 struct _XcursorImage;
 namespace barock {
 
-  class renderer_t {
+  /**
+   * @brief A surface to show on an overlay plane, instead of drawing
+   * it into the frame.
+   */
+  struct plane_assignment_t {
+    surface_t *surface;
+    region_t   bounds; ///< Where the surface is on screen
+  };
+
+  class renderer_t : public kms_t {
     public:
     virtual ~renderer_t() = default;
     /**
@@ -16,12 +31,69 @@ namespace barock {
     virtual void
     bind() = 0;
 
+    /**
+     * @brief Age of the backbuffer acquired by `bind', i.e. how many
+     * frames ago its contents were drawn.  0 means the contents are
+     * undefined and the whole frame has to be redrawn.
+     */
+    virtual int
+    buffer_age() const = 0;
+
     /**
      * @brief Commit the current backbuffer to be displayed to the
-     * user.
+     * user.  This does not wait for the frame to reach the screen,
+     * `on_presented' is called with the presentation feedback of
+     * the page flip once it did.
      */
     virtual void
-    commit() = 0;
+    commit(present_handler_t on_presented) = 0;
+
+    /**
+     * @brief Put the buffer of `surface' on screen as is, instead of
+     * compositing a frame.  The buffer has to cover the whole output.
+     * Returns false, if it can't be scanned out, nothing is presented
+     * in that case.  `on_presented' is the same as with `commit'.
+     */
+    virtual bool
+    scanout(surface_t &surface, present_handler_t on_presented) = 0;
+
+    /**
+     * @brief Number of overlay planes available for `overlay'.
+     */
+    virtual size_t
+    planes() const = 0;
+
+    /**
+     * @brief Test whether the display engine accepts `assignments',
+     * one surface per overlay plane.  If it does, the next `commit' or
+     * `commit_planes' puts them on screen, otherwise returns false and
+     * keeps the previous assignment.
+     */
+    virtual bool
+    overlay(const std::vector<plane_assignment_t> &assignments) = 0;
+
+    /**
+     * @brief Only update the overlay planes, the composited frame on
+     * screen stays as is.  `on_presented' is the same as with `commit'.
+     * Returns false if that failed, a frame has to be composited then.
+     */
+    virtual bool
+    commit_planes(present_handler_t on_presented) = 0;
+
+    /**
+     * @brief Let the following `commit' and `scanout' flip right away
+     * instead of waiting for vblank, at the cost of tearing.  This is
+     * only a hint, drivers that can't do that wait as usual.
+     */
+    virtual void
+    tearing(bool allow) = 0;
+
+    /**
+     * @brief Restrict all following clears and draws of this frame to
+     * `rects' (screenspace).  The rectangles must not overlap.
+     */
+    virtual void
+    clip(const std::vector<region_t> &rects) = 0;
 
     virtual void
     clear(float r, float g, float b, float a) = 0;
@@ -34,5 +106,21 @@ namespace barock {
 
     virtual void
     draw(_XcursorImage *, const fpoint_t &screen_position) = 0;
+
+    /**
+     * @brief Put a cursor image (premultiplied ARGB8888) on a hardware
+     * cursor plane, `nullptr' hides it again.  Returns false when there
+     * is no cursor plane or the image does not fit, the cursor then
+     * has to be drawn with `draw'.
+     */
+    virtual bool
+    cursor(const uint32_t *pixels, const ipoint_t &size, uint32_t stride) = 0;
+
+    /**
+     * @brief Move the hardware cursor, `screen_position' is the top
+     * left corner of the image.
+     */
+    virtual void
+    move_cursor(const ipoint_t &screen_position) = 0;
   };
 };
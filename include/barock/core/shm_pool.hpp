@@ -2,9 +2,14 @@
 
 #include "barock/resource.hpp"
 #include "wl/wayland-protocol.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
 #include <vector>
 
 extern struct wl_shm_pool_interface wl_shm_pool_impl;
+extern struct wl_buffer_interface   wl_buffer_impl;
 
 namespace barock {
   struct shm_buffer_t;
@@ -19,12 +24,76 @@ namespace barock {
     ~shm_pool_t();
   };
 
+  /**
+   * @brief Describes the dmabuf backing a buffer, this is what lets
+   * the buffer be sampled and scanned out without a copy.
+   */
+  struct dmabuf_attributes_t {
+    static constexpr uint32_t MAX_PLANES = 4;
+
+    struct plane_t {
+      int32_t  fd; ///< Owned by the buffer
+      uint32_t offset, stride;
+    };
+
+    std::array<plane_t, MAX_PLANES> planes;
+    uint32_t                        num_planes;
+    uint32_t                        format; ///< DRM fourcc, not a `wl_shm_format'
+    uint64_t                        modifier;
+  };
+
   struct shm_buffer_t {
-    shared_t<shm_pool_t> pool;
-    int32_t              offset, width, height, stride;
-    uint32_t             format;
+    shared_t<shm_pool_t>               pool; ///< Null, if the client created a dmabuf directly
+    int32_t                            offset, width, height, stride;
+    uint32_t                           format;
+    std::optional<dmabuf_attributes_t> dmabuf; ///< Set, if the buffer is backed by a dmabuf
+    std::atomic<uint32_t>              busy{ 0 }; ///< Number of `buffer_ref_t's holding it
+    std::atomic<uint64_t>              lent{ 0 }; ///< Times `busy' went up from 0
+    bool                               exported{ false }; ///< Tried the pool as a dmabuf yet
+
+    ~shm_buffer_t();
 
     void *
     data();
+
+    /**
+     * @brief Called as a client attaches the buffer, before any render
+     * thread sees it.  The first time, the pool memory is turned into a
+     * dmabuf if it can be, buffers that are never shown don't cost one.
+     */
+    void
+    attached();
+
+    /**
+     * @brief The DRM fourcc of the buffer, `format' has the two
+     * `wl_shm' formats that don't match their fourcc.
+     */
+    uint32_t
+    fourcc() const;
+  };
+
+  /**
+   * @brief Keeps a buffer from going back to the client, for as long
+   * as we may still read it.  Whoever reads a buffer (the attached
+   * surface state, a flip, the screen) holds one of these, the last
+   * one to go sends `wl_buffer.release'.  That happens on the wayland
+   * thread, whichever thread lets go.
+   */
+  class buffer_ref_t {
+    public:
+    buffer_ref_t() = default;
+    explicit buffer_ref_t(shared_t<resource_t<shm_buffer_t>> buffer);
+    buffer_ref_t(const buffer_ref_t &other);
+    buffer_ref_t(buffer_ref_t &&other);
+    ~buffer_ref_t();
+
+    buffer_ref_t &
+    operator=(buffer_ref_t other);
+
+    const shared_t<resource_t<shm_buffer_t>> &
+    get() const;
+
+    private:
+    shared_t<resource_t<shm_buffer_t>> buffer_;
   };
 };
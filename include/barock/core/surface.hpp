@@ -3,14 +3,20 @@
 #include "barock/core/metadata.hpp"
 #include "barock/core/point.hpp"
 #include "barock/core/region.hpp"
+#include "barock/core/shm_pool.hpp"
 #include "barock/core/signal.hpp"
 #include "barock/core/wl_subcompositor.hpp"
 #include "barock/resource.hpp"
 #include "wl/wayland-protocol.h"
 #include <jsl/optional.hpp>
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <utility>
 #include <vector>
 
 extern struct wl_surface_interface wl_surface_impl;
@@ -20,6 +26,7 @@ namespace barock {
   struct shm_buffer_t;
   struct subsurface_t;
   struct output_t;
+  struct presentation_t;
 
   struct base_surface_role_t {
     base_surface_role_t()          = default;
@@ -48,19 +55,33 @@ namespace barock {
 
   struct surface_t;
   struct surface_state_t {
+    /// Fields of `surface_t::staging' set since the last commit
+    enum dirty_t : uint32_t {
+      eBuffer    = 1 << 0,
+      eDamage    = 1 << 1,
+      eOpaque    = 1 << 2,
+      eInput     = 1 << 3,
+      eTransform = 1 << 4,
+      eScale     = 1 << 5,
+      eOffset    = 1 << 6,
+      eTearing   = 1 << 7,
+      eChildren  = 1 << 8, ///< Subsurfaces added, moved or restacked
+    };
+
+    uint32_t                           dirty;
     region_t                           opaque;
     region_t                           input;
     std::optional<region_t>            damage;
     shared_t<resource_t<shm_buffer_t>> buffer;
     int32_t                            transform;
     int32_t                            scale;
-    wl_resource                       *pending;
+    std::vector<wl_resource *>         frames;   ///< `wl_surface.frame' callbacks not yet drawn
+    std::vector<wl_resource *>         feedback; ///< `wp_presentation_feedback' of this commit
+    buffer_ref_t hold; ///< Keeps `buffer' from the client while we may still read it
+    bool tearing; ///< The client prefers latency over vsync (`wp_tearing_control')
     struct {
       int32_t x, y;
     } offset;
-
-    shared_t<subsurface_t>              subsurface;
-    std::vector<shared_t<subsurface_t>> children;
   };
 
   struct surface_t {
@@ -74,23 +95,135 @@ namespace barock {
     // duplicate-able by nature.
     surface_t(const surface_t &) = delete;
 
-    virtual ~surface_t() = default;
+    virtual ~surface_t();
 
     surface_state_t state,
       staging; // Surface state is double buffered
 
     shared_t<base_surface_role_t> role;
 
+    shared_t<subsurface_t> subsurface; ///< Set when this is the subsurface of another surface
+
+    /// Subsurfaces from the bottom-most to the top-most, as applied
+    /// and as of the next commit of this surface
+    subsurface_list_t children{ &subsurface_t::link };
+    subsurface_list_t pending_children{ &subsurface_t::pending_link };
+
+    /// A subsurface where the last applied commit of its parent put it
+    struct child_t {
+      weak_t<surface_t> surface;
+      ipoint_t          position; ///< Relative to the parent
+    };
+    using stacking_t = std::shared_ptr<const std::vector<child_t>>;
+
     struct {
       signal_t<shm_buffer_t &>                on_buffer_attach;
+      signal_t<surface_t &>                   on_buffer_detach; ///< A commit attached nullptr
       signal_t<const region_t &, surface_t &> on_damage;
+      signal_t<surface_t &>                   on_destroy;
+      signal_t<surface_t &>                   on_frame; ///< Committed frame callbacks, no damage
     } events;
 
     metadata_t metadata;
 
+    /// When (msec) an output last wanted to show the buffer on a plane
+    std::atomic<uint32_t> offload_msec{ 0 };
+
     void
     operator=(const surface_t &) = delete;
 
+    /**
+     * @brief Whether commits are cached until the parent commits,
+     * because this or one of the parent surfaces is a synchronized
+     * subsurface.
+     */
+    bool
+    synchronized() const;
+
+    /**
+     * @brief Apply the pending state, or cache it while the surface is
+     * synchronized.
+     */
+    void
+    commit();
+
+    /**
+     * @brief Apply what was cached while the surface was synchronized,
+     * then do the same for the subsurfaces.
+     */
+    void
+    apply_cached();
+
+    /**
+     * @brief Report damage in surface local coordinates to whoever
+     * shows the surface tree.
+     */
+    void
+    damage(const region_t &region);
+
+    /**
+     * @brief The damage of the commits after `commit', in buffer
+     * coordinates, along with the commit we are at now.  When those
+     * are too far back to tell, it is the whole buffer.  Render
+     * threads keep track of what they uploaded, nothing is consumed.
+     */
+    std::pair<region_t, uint64_t>
+    damage_since(uint64_t commit) const;
+
+    /**
+     * @brief Whether the current state has a frame callback or
+     * presentation feedback, that waits for it to be drawn.
+     */
+    bool
+    frame_pending() const;
+
+    /**
+     * @brief Mark the pending frame callback and presentation feedback
+     * as drawn into the frame the caller paints.  They are completed by
+     * `frame_done', once that frame is on screen.  `flags' are added to
+     * the feedback, i.e. `zero_copy' when the buffer was not composited.
+     */
+    void
+    frame_drawn(uint32_t flags = 0);
+
+    /**
+     * @brief Complete the frame callbacks and presentation feedback
+     * drawn on `output' up to `presentation.frame', on this surface
+     * and its subsurfaces.  The feedback of a discarded frame is discarded.
+     */
+    void
+    frame_done(output_t &output, const presentation_t &presentation);
+
+    /**
+     * @brief Complete the frame callbacks right away without drawing,
+     * on this surface and its subsurfaces, and discard the presentation
+     * feedback.  This is how surfaces nobody can see are throttled.
+     */
+    void
+    frame_skip(uint32_t msec);
+
+    /**
+     * @brief Forget about a destroyed frame callback or presentation
+     * feedback.
+     */
+    void
+    frame_forget(wl_resource *callback);
+
+    /**
+     * @brief The applied `children', from the bottom-most to the
+     * top-most.  `children' belongs to the wayland thread, the render
+     * thread walks this snapshot instead, it is never modified.
+     */
+    stacking_t
+    stacking() const;
+
+    /**
+     * @brief Publish a new snapshot of `children' to `stacking', after
+     * subsurfaces were linked or unlinked.
+     */
+    void
+    restack();
+
     /**
      * @brief Compute the full extent of a surface by recursively adding up buffer sizes.
      * The returned region encompasses a region that the entire tree of surfaces takes up.
@@ -104,6 +237,22 @@ namespace barock {
     ipoint_t
     extent() const;
 
+    /**
+     * @brief The part of the surface that is known to be opaque, in
+     * surface local coordinates.  Buffers without alpha are opaque as a
+     * whole, otherwise the opaque region is clipped to the buffer.
+     */
+    region_t
+    opaque_region() const;
+
+    /**
+     * @brief A render thread copied `buffer' and doesn't need it any
+     * longer, the client may have it back.  The wayland thread drops
+     * our hold on it, as long as it is still attached by then.
+     */
+    void
+    copied(shared_t<resource_t<shm_buffer_t>> buffer);
+
     /**
      * @brief Returns the position of this surface, relative to all parent surfaces.
      */
@@ -127,6 +276,45 @@ namespace barock {
 
     shared_t<surface_t>
     lookup(const ipoint_t &);
+
+    private:
+    surface_state_t cached_;              ///< Commits made while synchronized
+    bool            has_cached_{ false }; ///< Whether `cached_' holds a commit
+
+    void
+    apply(surface_state_t &pending);
+
+    /// Expires along with us, for work that was deferred to the event loop
+    std::shared_ptr<surface_t *> self_;
+
+    mutable std::mutex children_mutex_; ///< Guards swapping `stacking_'
+    stacking_t         stacking_{ std::make_shared<const std::vector<child_t>>() };
+
+    /**
+     * @brief Move what `pending' changed into `state' and return what
+     * that was.  Only the changed fields are touched, nothing here
+     * allocates once the callback vectors reached their working size.
+     */
+    uint32_t
+    merge(surface_state_t &state, surface_state_t &pending);
+
+    /// A frame callback or presentation feedback, drawn into `frame' of `output'
+    struct drawn_t {
+      wl_resource    *resource;
+      const output_t *output;
+      uint64_t        frame; ///< See `output_t::painting'
+      uint32_t        flags; ///< Feedback kind flags, unused for callbacks
+    };
+
+    static constexpr size_t DAMAGE_HISTORY = 4; ///< Commits `damage_since' looks back on
+
+    mutable std::mutex                   damage_mutex_;
+    std::array<region_t, DAMAGE_HISTORY> damage_history_; ///< Of the last commits, by number
+    uint64_t                             commits_{ 0 };   ///< Commits that carried damage
+
+    mutable std::mutex   frame_mutex_;
+    std::vector<drawn_t> frame_callbacks_; ///< Drawn, but not yet presented
+    std::vector<drawn_t> feedback_;        ///< Drawn presentation feedback, not yet presented
   };
 
 };
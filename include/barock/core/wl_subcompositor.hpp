@@ -1,6 +1,6 @@
 #pragma once
 
-#include "barock/core/wl_compositor.hpp"
+#include "barock/core/point.hpp"
 #include "barock/resource.hpp"
 
 #include "wl/wayland-protocol.h"
@@ -15,11 +15,109 @@ namespace barock {
   struct surface_t;
   struct service_registry_t;
 
+  struct subsurface_t;
+  struct subsurface_list_t;
+
+  /// Links a subsurface into one of the lists of its parent
+  struct subsurface_link_t {
+    subsurface_list_t *list{ nullptr };
+    subsurface_t      *prev{ nullptr }, *next{ nullptr }; ///< Siblings below & above
+  };
+
+  /**
+   * @brief The subsurfaces of a surface, from the bottom-most to the
+   * top-most.  The list is intrusive and never copied, linking and
+   * unlinking doesn't allocate.  `link' selects which of the links of
+   * a subsurface the list uses.
+   */
+  struct subsurface_list_t {
+    subsurface_link_t subsurface_t::*link;
+    subsurface_t                    *head{ nullptr }, *tail{ nullptr };
+
+    struct iterator_t {
+      subsurface_t                    *node;
+      subsurface_link_t subsurface_t::*link;
+
+      subsurface_t &
+      operator*() const {
+        return *node;
+      }
+
+      subsurface_t *
+      operator->() const {
+        return node;
+      }
+
+      iterator_t &
+      operator++();
+
+      bool
+      operator==(const iterator_t &) const = default;
+    };
+
+    explicit subsurface_list_t(subsurface_link_t subsurface_t::*link);
+    subsurface_list_t(subsurface_list_t &&);
+    subsurface_list_t(const subsurface_list_t &) = delete;
+    ~subsurface_list_t();
+
+    void
+    operator=(const subsurface_list_t &) = delete;
+
+    bool
+    empty() const {
+      return head == nullptr;
+    }
+
+    iterator_t
+    begin() const {
+      return { head, link };
+    }
+
+    iterator_t
+    end() const {
+      return { nullptr, link };
+    }
+
+    /// Link `subsurface' on top of all others
+    void
+    push_back(subsurface_t &subsurface);
+
+    /// Link `subsurface' right below `above', or on top if that is nullptr
+    void
+    insert(subsurface_t *above, subsurface_t &subsurface);
+
+    /// Unlink `subsurface', if it is part of this list
+    void
+    erase(subsurface_t &subsurface);
+
+    /// Unlink all subsurfaces
+    void
+    clear();
+  };
+
   struct subsurface_t {
-    ipoint_t          position;
+    ipoint_t          position, pending; ///< Position in the parent, `pending' for its next commit
     weak_t<surface_t> surface, parent;
+
+    /// Commits of the surface are cached until the parent is committed
+    bool sync{ true };
+
+    subsurface_link_t link;         ///< In the stacking order of the parent
+    subsurface_link_t pending_link; ///< In the stacking order of the parent's next commit
+
+    ~subsurface_t();
+
+    /// Remove the subsurface from its parent
+    void
+    unlink();
   };
 
+  inline subsurface_list_t::iterator_t &
+  subsurface_list_t::iterator_t::operator++() {
+    node = (node->*link).next;
+    return *this;
+  }
+
   struct wl_subcompositor_t {
     public:
     wl_global           *wl_subcompositor_global;
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "wl/presentation-time-protocol.h"
+
+extern struct wp_presentation_interface wp_presentation_impl;
+
+namespace barock {
+  struct service_registry_t;
+
+  struct wp_presentation_t {
+    public:
+    static constexpr int VERSION = 1;
+    wl_global           *wp_presentation_global;
+    wl_display          *display;
+    service_registry_t  &registry;
+
+    wp_presentation_t(wl_display *, service_registry_t &registry);
+
+    static void
+    bind(wl_client *, void *, uint32_t, uint32_t);
+  };
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "wl/tearing-control-v1-protocol.h"
+
+extern struct wp_tearing_control_manager_v1_interface wp_tearing_control_manager_impl;
+extern struct wp_tearing_control_v1_interface         wp_tearing_control_impl;
+
+namespace barock {
+  struct service_registry_t;
+
+  /**
+   * @brief Stored in the metadata of a surface, while it has a
+   * `wp_tearing_control_v1' object.
+   */
+  struct tearing_control_t {
+    wl_resource *resource = nullptr;
+  };
+
+  struct wp_tearing_control_t {
+    public:
+    static constexpr int VERSION = 1;
+    wl_global           *wp_tearing_control_global;
+    wl_display          *display;
+    service_registry_t  &registry;
+
+    wp_tearing_control_t(wl_display *, service_registry_t &registry);
+
+    static void
+    bind(wl_client *, void *, uint32_t, uint32_t);
+  };
+}
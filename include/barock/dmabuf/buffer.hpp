@@ -3,3 +3,10 @@
 #include "wl/linux-dmabuf-v1-protocol.h"
 
 extern struct zwp_linux_buffer_params_v1_interface linux_buffer_params_impl;
+
+/**
+ * @brief Create a `zwp_linux_buffer_params_v1' object, that collects
+ * the planes of a dmabuf until the client turns it into a `wl_buffer'.
+ */
+void
+create_linux_buffer_params(wl_client *client, wl_resource *dmabuf_protocol, uint32_t id);
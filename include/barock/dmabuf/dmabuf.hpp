@@ -1,5 +1,7 @@
 #pragma once
 
+#include "barock/dmabuf/feedback.hpp"
+#include "minidrm.hpp"
 #include "wl/wayland-protocol.h"
 #include <wayland-server-core.h>
 
@@ -59,17 +61,20 @@
 */
 
 namespace barock {
-  struct compositor_t;
+  struct service_registry_t;
 
   class dmabuf_t {
     public:
     static constexpr int VERSION = 5;
-    dmabuf_t(compositor_t &);
+    wl_global             *dmabuf_global;
+    wl_display            *display;
+    service_registry_t    &registry;
+    minidrm::drm::handle_t drm; ///< Device client buffers are test-imported on
+    dmabuf_formats_t       formats;
+
+    dmabuf_t(wl_display *, service_registry_t &registry, minidrm::drm::handle_t &drm);
 
     static void
     bind(wl_client *client, void *, uint32_t version, uint32_t id);
-
-    private:
-    compositor_t &compositor;
   };
 }
@@ -1,8 +1,62 @@
 #pragma once
 
+#include "minidrm.hpp"
 #include "wl/linux-dmabuf-v1-protocol.h"
 
+#include <cstdint>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
 extern struct zwp_linux_dmabuf_feedback_v1_interface linux_dmabuf_feedback_impl;
 
+namespace barock {
+  /**
+   * @brief The format/modifier pairs we can import, queried from EGL
+   * once.  The table lives in a sealed memfd that every feedback
+   * object shares.
+   */
+  struct dmabuf_formats_t {
+    using pair_t = std::pair<uint32_t, uint64_t>; ///< DRM fourcc and modifier
+
+    int                   fd;      ///< Sealed, read-only format table
+    size_t                size;    ///< Size of the table in bytes
+    dev_t                 device;  ///< The device we render and scan out with
+    std::vector<pair_t>   pairs;   ///< The entries of the table, in order
+    std::vector<uint16_t> all;     ///< Indices of all pairs we can sample
+    std::vector<uint16_t> scanout; ///< Indices of the pairs the KMS planes can show
+
+    dmabuf_formats_t(minidrm::drm::handle_t &drm);
+    dmabuf_formats_t(const dmabuf_formats_t &) = delete;
+    ~dmabuf_formats_t();
+
+    /**
+     * @brief Whether we advertised `format' with `modifier'.
+     */
+    bool
+    supported(uint32_t format, uint64_t modifier) const;
+
+    /**
+     * @brief Send all parameters to a `zwp_linux_dmabuf_feedback_v1',
+     * with a scanout tranche first if `scanout' is set.
+     */
+    void
+    send(wl_resource *feedback, bool scanout) const;
+  };
+}
+
+/**
+ * @brief Create a feedback object, that is not tied to a surface.
+ */
 void
 create_dmabuf_feedback_v1_resource(wl_client *client, wl_resource *dmabuf_protocol, uint32_t id);
+
+/**
+ * @brief Create a feedback object for `wl_surface', that is re-sent
+ * whenever the surface starts or stops qualifying for direct scanout.
+ */
+void
+create_dmabuf_surface_feedback_v1_resource(wl_client   *client,
+                                           wl_resource *dmabuf_protocol,
+                                           uint32_t     id,
+                                           wl_resource *wl_surface);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "barock/core/shm_pool.hpp"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace barock {
+  /// Why params can't take a plane or become a buffer
+  struct params_error_t {
+    uint32_t    code; ///< `zwp_linux_buffer_params_v1' error
+    std::string message;
+  };
+
+  /**
+   * @brief The planes a client added to a `zwp_linux_buffer_params_v1'
+   * so far, and the rules they have to follow.  The fds belong to
+   * whoever holds the params, until a buffer takes them over.
+   */
+  struct dmabuf_params_t {
+    std::array<dmabuf_attributes_t::plane_t, dmabuf_attributes_t::MAX_PLANES> planes;
+    uint32_t added    = 0; ///< Bitmask of the plane indices that were set
+    uint64_t modifier = 0; ///< Of all planes, once one was added
+    bool     used     = false;
+
+    /**
+     * @brief Add a plane.  `same_modifier' holds all planes to the
+     * modifier of the first one, as version 5 does.  `fd' is only ours
+     * if there was no error.
+     */
+    std::optional<params_error_t>
+    add(int32_t  fd,
+        uint32_t plane_idx,
+        uint32_t offset,
+        uint32_t stride,
+        uint64_t modifier,
+        bool     same_modifier);
+
+    /**
+     * @brief Check the params of `create' and `create_immed', and mark
+     * them used.  `advertised' is whether the client may use `format'
+     * with our modifier.
+     */
+    std::optional<params_error_t>
+    check(int32_t width, int32_t height, uint32_t format, bool advertised);
+  };
+}
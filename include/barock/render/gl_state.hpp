@@ -0,0 +1,98 @@
+#pragma once
+
+#include <GLES2/gl2.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+namespace barock {
+  /**
+   * @brief Shadow of the GL state the renderers touch, calls that would
+   * not change anything are skipped.  GL state belongs to the context;
+   * every output's egl_t owns one, shared with the others, and only its
+   * render thread makes it current.  `current' keeps a tracker per
+   * thread and starts over when the thread's context changes.  Whatever
+   * changes this state has to go through it.
+   */
+  class gl_state_t {
+    public:
+    static constexpr GLuint UNITS = 8; ///< Texture units that are tracked
+
+    /// The tracker of the context current on the calling thread
+    static gl_state_t &
+    current();
+
+    void
+    use_program(GLuint program);
+
+    void
+    bind_framebuffer(GLuint framebuffer);
+
+    /// Delete framebuffers, GL unbinds them if they are bound
+    void
+    delete_framebuffers(GLsizei count, const GLuint *framebuffers);
+
+    /// Bind `texture' to GL_TEXTURE_2D of `unit', leaves `unit' active
+    void
+    bind_texture(GLuint unit, GLuint texture);
+
+    /// Delete textures, GL unbinds them wherever they are bound in
+    /// this context.  Other threads rebind their textures afterwards.
+    void
+    delete_textures(GLsizei count, const GLuint *textures);
+
+    /// Bind GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+    void
+    bind_buffer(GLenum target, GLuint buffer);
+
+    /// Delete buffers, GL unbinds them if they are bound
+    void
+    delete_buffers(GLsizei count, const GLuint *buffers);
+
+    /// Enable exactly the vertex attribute arrays in `mask'
+    void
+    attributes(uint32_t mask);
+
+    void
+    blend(bool enable);
+
+    void
+    blend_func(GLenum src, GLenum dst);
+
+    void
+    viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    void
+    scissor(bool enable);
+
+    void
+    scissor_box(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    /// GL calls skipped so far, on all threads
+    static uint64_t
+    saved();
+
+    private:
+    using box_t = std::array<GLint, 4>;
+
+    /// Whether `value' differs from `cached', updates it if so
+    template<typename _Ty>
+    bool
+    update(_Ty &cached, const _Ty &value);
+
+    /// Bumped whenever a texture is deleted, names are shared by all
+    /// contexts and the one freed may be bound in ours.
+    static std::atomic<uint64_t> deleted_;
+    static std::atomic<uint64_t> saved_;
+
+    uint64_t                  seen_{ 0 }; ///< `deleted_' as of our last texture bind
+    GLuint                    program_{ 0 }, unit_{ 0 }, framebuffer_{ 0 };
+    std::array<GLuint, UNITS> textures_{};
+    GLuint                    array_buffer_{ 0 }, element_buffer_{ 0 };
+    uint32_t                  attributes_{ 0 };
+    bool                      blend_{ false }, scissor_{ false };
+    std::pair<GLenum, GLenum> blend_func_{ GL_ONE, GL_ZERO };
+    box_t                     viewport_{ -1, -1, -1, -1 }, scissor_box_{ -1, -1, -1, -1 };
+  };
+}
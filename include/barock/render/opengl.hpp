@@ -1,49 +1,135 @@
 #pragma once
 
 #include "barock/core/renderer.hpp"
+#include "barock/core/shm_pool.hpp"
+#include "barock/render/gl_state.hpp"
 #include "minidrm.hpp"
 #include <GLES2/gl2.h>
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <span>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
 namespace barock {
 
-  class gl_shader_t {
-    private:
-    GLuint handle_;
+  /**
+   * @brief Compile and link a program, or load it from the on-disk
+   * program binary cache.  `attributes' are bound to their index.
+   */
+  GLuint
+  gl_link_program(const char                  *name,
+                  const char                  *vertex,
+                  const char                  *fragment,
+                  std::span<const char *const> attributes);
 
+  /**
+   * @brief A linked program, described by `_Layout': its GLSL sources
+   * `VERTEX' and `FRAGMENT', and the names of its attributes and
+   * uniforms, indexed by its enums `attribute_t' and `uniform_t'.
+   * Attributes are bound to their index, uniforms are looked up once
+   * after linking, so drawing never looks up a name.
+   */
+  template<typename _Layout>
+  class gl_program_t {
     public:
-    gl_shader_t(GLuint);
+    using attribute_t = typename _Layout::attribute_t;
+    using uniform_t   = typename _Layout::uniform_t;
 
-    void
-    bind();
+    gl_program_t()
+      : handle_(
+          gl_link_program(_Layout::NAME, _Layout::VERTEX, _Layout::FRAGMENT, _Layout::ATTRIBUTES)) {
+      for (size_t i = 0; i < uniforms_.size(); ++i)
+        uniforms_[i] = glGetUniformLocation(handle_, _Layout::UNIFORMS[i]);
+    }
 
-    void
-    uniform(const std::string &name, float) const;
+    gl_program_t(const gl_program_t &) = delete;
 
-    void
-    uniform(const std::string &name, float, float) const;
+    operator GLuint() const {
+      return handle_;
+    }
 
-    void
-    uniform(const std::string &name, float, float, float) const;
+    template<uniform_t _Uniform>
+    GLint
+    uniform() const {
+      return uniforms_[_Uniform];
+    }
 
-    void
-    uniform(const std::string &name, float, float, float, float) const;
+    private:
+    GLuint                                          handle_;
+    std::array<GLint, std::size(_Layout::UNIFORMS)> uniforms_;
+  };
 
-    void
-    uniform(const std::string &name, int) const;
+  /// The program that draws the quad batch of `gl_renderer_t'
+  struct gl_quad_layout_t {
+    enum attribute_t : GLuint { aPosition, aTexcoord, aTexture };
+    enum uniform_t : size_t { uScreenSize, uTextures };
+
+    static constexpr const char *NAME         = "quad";
+    static constexpr const char *ATTRIBUTES[] = { "a_position", "a_texcoord", "a_texture" };
+    static constexpr const char *UNIFORMS[]   = { "u_screen_size", "u_textures" };
+    static const char *const     VERTEX;
+    static const char *const     FRAGMENT;
+  };
+
+  using gl_quad_program_t = gl_program_t<gl_quad_layout_t>;
 
-    operator GLuint() const;
+  struct gl_texture_t {
+    GLuint  handle;
+    int32_t width, height;
   };
 
-  class gl_shader_storage_t {
+  /**
+   * @brief Textures of client surfaces, shared by all GL renderers.
+   *
+   * A shm surface keeps its texture for as long as it lives, on every
+   * frame only the region the client damaged since the last upload is
+   * copied to the GPU.  Dmabuf buffers are not copied at all, each is
+   * imported once as an EGLImage that the texture samples directly.
+   */
+  class gl_texture_cache_t {
     public:
-    const gl_shader_t &
-    by_name(const std::string &) const;
+    /**
+     * @brief Return the texture for `surface', uploading the damage of
+     * the commits since the last call.  The handle is 0, if a dmabuf
+     * could not be imported.
+     */
+    gl_texture_t
+    upload(surface_t &surface);
+
+    /**
+     * @brief Delete the textures of all surfaces and buffers that were
+     * destroyed since the last call. Requires a current GL context.
+     */
     void
-    add(const std::string &, const gl_shader_t &);
+    collect();
 
     private:
-    std::map<std::string, gl_shader_t> shaders_;
+    struct surface_texture_t {
+      gl_texture_t shm{ 0, 0, 0 }; ///< Copy of the last shm buffer
+      uint64_t     commit{ 0 };    ///< Last commit uploaded, see `surface_t::damage_since'
+    };
+
+    struct image_t {
+      EGLImageKHR  image;
+      gl_texture_t texture;
+    };
+
+    /**
+     * @brief Import `buffer' through EGL_EXT_image_dma_buf_import, once
+     * per buffer.  Requires `mutex_' to be held.
+     */
+    gl_texture_t
+    import(const shared_t<resource_t<shm_buffer_t>> &buffer);
+
+    std::mutex                                               mutex_;
+    std::unordered_map<const surface_t *, surface_texture_t> textures_;
+    std::unordered_map<const shm_buffer_t *, image_t>        images_;
+    std::vector<GLuint>                                      graveyard_;
+    std::vector<EGLImageKHR> image_graveyard_; ///< Images of destroyed buffers
   };
 
   class gl_renderer_t : public renderer_t {
@@ -51,6 +137,97 @@ namespace barock {
     minidrm::framebuffer::egl_t               handle_;
     minidrm::drm::mode_t                      mode_;
     minidrm::framebuffer::egl_t::egl_buffer_t frontbuffer_;
+    std::vector<region_t>                     clip_;
+    bool                                      tearing_; ///< Flip without waiting for vblank
+
+    // Quads are not drawn one by one, they are collected into a batch
+    // that is drawn with as few draw calls as possible.  Each draw call
+    // samples up to `BATCH_TEXTURES' textures, one per texture unit.
+    struct vertex_t {
+      GLfloat x, y;    ///< Screen space position
+      GLfloat u, v;    ///< Texture coordinates
+      GLfloat texture; ///< Texture unit to sample
+    };
+
+    /// Consecutive quads drawn with the same blend state
+    struct run_t {
+      GLsizei quads;
+      bool    blend;
+    };
+
+    static constexpr size_t BATCH_TEXTURES = 8;    ///< Guaranteed by GLES2
+    static constexpr size_t BATCH_QUADS    = 4096; ///< Size of the vertex buffer
+
+    GLuint                vbo_{ 0 }, ibo_{ 0 };
+    std::vector<vertex_t> batch_;          ///< Vertices of the queued quads, four each
+    std::vector<run_t>    runs_;           ///< Draw calls of the batch, in order
+    std::vector<GLuint>   batch_textures_; ///< Textures sampled by the batch, by unit
+    std::vector<GLuint>   transient_;      ///< Textures deleted once the batch is drawn
+
+    // Direct scanout.  Imports are created on the render thread, the
+    // flip completion runs on the wayland thread.
+    using import_t  = minidrm::framebuffer::egl_t::egl_buffer_t;
+    using buffers_t = std::vector<buffer_ref_t>;
+    std::mutex                                         scanout_mutex_;
+    std::unordered_map<const shm_buffer_t *, import_t> imports_;
+    std::vector<import_t> graveyard_; ///< Imports of destroyed buffers, freed on the render thread
+    buffers_t             on_screen_; ///< Client buffers currently scanned out
+
+    std::vector<minidrm::framebuffer::egl_t::overlay_t>
+              overlays_;        ///< Overlay planes of the next flip, see `overlay'
+    buffers_t overlay_buffers_; ///< Client buffers shown by `overlays_'
+    buffers_t sampled_;         ///< Dmabufs sampled by the frame being drawn
+
+    /**
+     * @brief Import the dmabuf of `buffer' for scanout, once.
+     */
+    import_t
+    import(shared_t<resource_t<shm_buffer_t>> buffer);
+
+    /**
+     * @brief Called once a flip landed, with the client buffers it put
+     * on screen.
+     */
+    void
+    flipped(const buffers_t &buffers);
+
+    /**
+     * @brief Flip handler that calls `flipped' with `buffers', and
+     * `on_presented' with the feedback of the flip.
+     */
+    minidrm::framebuffer::egl_t::flip_handler_t
+    on_flip(buffers_t buffers, present_handler_t on_presented);
+
+    /**
+     * @brief Free the imports of buffers that were destroyed.
+     */
+    void
+    collect();
+
+    /**
+     * @brief Invoke `fn' once for every clip rectangle that
+     * intersects `bounds', with the scissor box set to that rectangle.
+     */
+    template<typename _Fn>
+    void
+    scissored(const region_t &bounds, _Fn &&fn);
+
+    /**
+     * @brief Queue a quad showing `texture' at `position', cut down to
+     * the clip rectangles.  The part inside `opaque', relative to
+     * `position', is drawn without blending.
+     */
+    void
+    push(GLuint          texture,
+         const fpoint_t &position,
+         const fpoint_t &size,
+         const region_t &opaque = {});
+
+    /**
+     * @brief Draw all queued quads.
+     */
+    void
+    flush();
 
     public:
     gl_renderer_t(const minidrm::drm::mode_t &, minidrm::framebuffer::egl_t &&);
@@ -62,16 +239,49 @@ namespace barock {
     void
     bind() override;
 
+    int
+    buffer_age() const override;
+
+    void
+    commit(present_handler_t on_presented) override;
+
+    bool
+    scanout(surface_t &surface, present_handler_t on_presented) override;
+
+    size_t
+    planes() const override;
+
+    bool
+    overlay(const std::vector<plane_assignment_t> &assignments) override;
+
+    bool
+    commit_planes(present_handler_t on_presented) override;
+
+    void
+    tearing(bool allow) override;
+
+    bool
+    vrr(bool enable) override;
+
+    bool
+    repeat(present_handler_t on_presented) override;
+
     void
-    commit() override;
+    clip(const std::vector<region_t> &rects) override;
 
     void
-    clear(float r, float g, float b, float a);
+    clear(float r, float g, float b, float a) override;
 
     void
     draw(surface_t &surface, const fpoint_t &screen_position) override;
 
     void
     draw(_XcursorImage *pointer, const fpoint_t &screen_position) override;
+
+    bool
+    cursor(const uint32_t *pixels, const ipoint_t &size, uint32_t stride) override;
+
+    void
+    move_cursor(const ipoint_t &screen_position) override;
   };
 }
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "barock/core/region.hpp"
+
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace barock {
+  /// A window as far as covering others goes, in workspace coordinates
+  struct window_cover_t {
+    region_t bounds; ///< The window and its subsurfaces
+    region_t opaque; ///< What nothing below shows through, empty if unknown
+  };
+
+  /**
+   * @brief Whether the window at `index' of `windows', top most first,
+   * lies entirely within the opaque region of a window above it.
+   */
+  bool
+  covered(std::span<const window_cover_t> windows, size_t index);
+
+  /**
+   * @brief Gathers the windows that wait for their frame callbacks,
+   * from every output, and whether any output shows them.  The ones
+   * nobody can see are `hidden', their callbacks are completed at a
+   * trickle instead of with a frame.
+   */
+  template<typename _Key>
+  class frame_throttle_t {
+    public:
+    /// `key' waits for a frame, and is `shown' on some output
+    void
+    waiting(const _Key &key, bool shown) {
+      for (auto &[waiting, seen] : waiting_) {
+        if (waiting == key) {
+          seen = seen || shown;
+          return;
+        }
+      }
+      waiting_.emplace_back(key, shown);
+    }
+
+    /// The waiting windows no output shows
+    std::vector<_Key>
+    hidden() const {
+      std::vector<_Key> hidden;
+      for (auto const &[key, seen] : waiting_)
+        if (!seen)
+          hidden.push_back(key);
+      return hidden;
+    }
+
+    private:
+    std::vector<std::pair<_Key, bool>> waiting_;
+  };
+}
@@ -65,10 +65,14 @@ namespace barock {
   class xdg_shell_t {
     public:
     static constexpr size_t XDG_SHELL_PAINT_LAYER = 100;
-    service_registry_t     &registry;
 
-    wl_display *display_;
-    wl_global  *global;
+    /// Windows nobody can see get their frame callbacks this often
+    static constexpr uint32_t HIDDEN_FRAME_MSEC = 1000;
+    service_registry_t       &registry;
+
+    wl_display      *display_;
+    wl_global       *global;
+    wl_event_source *throttle_; ///< Completes the frame callbacks of hidden windows
 
     struct {
       signal_t<shared_t<xdg_surface_t>> on_surface_new;
@@ -102,6 +106,19 @@ namespace barock {
 
     void raise_to_top(shared_t<xdg_surface_t>, jsl::optional_t<output_t &> = jsl::nullopt);
 
+    /**
+     * @brief Put the window on top of the output the cursor is on, if
+     * it isn't listed on any output yet.
+     */
+    void
+    map(shared_t<xdg_surface_t>);
+
+    /**
+     * @brief Take the window off every output, and repaint where it was.
+     */
+    void
+    unmap(const xdg_surface_t &);
+
     private:
     weak_t<resource_t<xdg_surface_t>> activated_;
 
@@ -113,5 +130,17 @@ namespace barock {
 
     signal_action_t
     paint(output_t &);
+
+    signal_action_t
+    scanout(output_t &, surface_t *&candidate);
+
+    signal_action_t
+    overlay(output_t &, std::vector<plane_assignment_t> &candidates);
+
+    signal_action_t
+    present(output_t &, const presentation_t &presentation);
+
+    static int
+    throttle(void *);
   };
 }
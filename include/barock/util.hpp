@@ -4,4 +4,21 @@
 namespace barock {
   uint32_t
   current_time_msec();
+
+  uint64_t
+  current_time_usec();
+
+  /**
+   * @brief Whether `format' (DRM fourcc) is YUV.  GL only samples these
+   * through GL_TEXTURE_EXTERNAL_OES, if at all.
+   */
+  bool
+  is_yuv(uint32_t format);
+
+  /**
+   * @brief Whether `format' (DRM fourcc) has no alpha channel, buffers
+   * in it are opaque as a whole, whatever the client claims.
+   */
+  bool
+  is_opaque(uint32_t format);
 }
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <cerrno>
 #include <cstring>
 #include <drm_fourcc.h>
 #include <fcntl.h>
@@ -34,8 +35,20 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+// Older libdrm headers predate async flips through atomic commits.
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
+#endif
+
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
 #include <filesystem>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -68,6 +81,8 @@ namespace minidrm {
     struct crtc_t;
     struct connector_t;
     struct mode_t;
+    struct plane_t;
+    struct property_t;
 
     struct card_t {
       fs::path path;
@@ -97,6 +112,7 @@ namespace minidrm {
       std::atomic<uintmax_t> *references;
 
       handle_data_t *data;
+      bool           atomic; ///< Driver accepted DRM_CLIENT_CAP_ATOMIC
 
 #if defined(MINIDRM_EGL)
       void
@@ -109,6 +125,24 @@ namespace minidrm {
       std::vector<crtc_t>
       crtcs() const;
 
+      std::vector<plane_t>
+      planes() const;
+
+      /**
+       * @brief Look up the property `name' on a KMS object, `type' is
+       * one of DRM_MODE_OBJECT_*.
+       */
+      std::optional<property_t>
+      property(uint32_t object, uint32_t type, const char *name) const;
+
+      /**
+       * @brief The format/modifier pairs `plane' can scan out, from its
+       * IN_FORMATS blob.  Drivers without one get every format the
+       * plane lists, with DRM_FORMAT_MOD_LINEAR.
+       */
+      std::vector<std::pair<uint32_t, uint64_t>>
+      plane_formats(uint32_t plane) const;
+
       handle_t(const handle_t &handle);
       ~handle_t();
 
@@ -181,16 +215,51 @@ namespace minidrm {
     struct crtc_t {
       public:
       uint32_t     id;
+      uint32_t     index; ///< Index into the resources, as used by `possible_crtcs' masks
       drmModeCrtc *crtc;
 
       crtc_t(const crtc_t &);
       ~crtc_t();
 
       private:
-      crtc_t(uint32_t, drmModeCrtc *);
+      crtc_t(uint32_t, uint32_t, drmModeCrtc *);
       friend class handle_t;
     };
 
+    struct plane_t {
+      uint32_t id;
+      uint32_t possible_crtcs;
+      uint64_t type; ///< DRM_PLANE_TYPE_PRIMARY, DRM_PLANE_TYPE_OVERLAY or DRM_PLANE_TYPE_CURSOR
+    };
+
+    struct property_t {
+      uint32_t id;
+      uint64_t value;
+    };
+
+    /**
+     * An atomic mode setting request.  Nothing reaches the hardware
+     * until `commit', `test' only asks the driver whether the
+     * configuration would be accepted.
+     */
+    struct atomic_t {
+      handle_t          drm;
+      drmModeAtomicReq *request;
+
+      atomic_t(const handle_t &);
+      atomic_t(const atomic_t &) = delete;
+      ~atomic_t();
+
+      void
+      add(uint32_t object, uint32_t property, uint64_t value);
+
+      bool
+      test(uint32_t flags = 0);
+
+      int
+      commit(uint32_t flags, void *user_data = nullptr);
+    };
+
     std::vector<card_t>
     cards();
   };
@@ -217,16 +286,89 @@ namespace minidrm {
 
       struct gbm_surface *surface;
       EGLSurface          egl_surface;
+      EGLContext          context; ///< Our own, shared with `drm->egl.context'
 
       struct egl_buffer_t {
         struct gbm_bo *bo;
         uint32_t       fb;
+        int32_t        age = 0; ///< Frames since this buffer was last drawn, 0 if unknown
+      };
+      bool                                   has_buffer_age; ///< EGL_EXT_buffer_age is supported
+      bool     atomic;        ///< Mode set and flip through atomic commits
+      uint32_t primary_plane; ///< Primary plane of `crtc', when `atomic'
+      uint32_t mode_blob;     ///< Property blob of `mode', when `atomic'
+      bool     async_flip;    ///< Driver can flip without waiting for vblank
+
+      // Property ids of the objects we touch in atomic commits
+      struct {
+        uint32_t connector_crtc_id;
+        uint32_t crtc_mode_id, crtc_active;
+        uint32_t plane_fb_id, plane_crtc_id;
+        uint32_t plane_src_x, plane_src_y, plane_src_w, plane_src_h;
+        uint32_t plane_crtc_x, plane_crtc_y, plane_crtc_w, plane_crtc_h;
+        uint32_t crtc_vrr_enabled; ///< 0 if the CRTC has no adaptive sync
+      } props;
+      bool vrr_capable; ///< The connector and CRTC can do adaptive sync, when `atomic'
+      bool vrr;         ///< Adaptive sync is wanted, applied with the next flip
+      bool vrr_enabled; ///< VRR_ENABLED as of the last flip
+      uint32_t scanout_fb; ///< Framebuffer on the primary plane, as of the last flip
+
+      struct overlay_plane_t {
+        uint32_t id;
+        struct {
+          uint32_t fb_id, crtc_id;
+          uint32_t src_x, src_y, src_w, src_h;
+          uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+        } props;
+      };
+      std::vector<overlay_plane_t> overlay_planes; ///< Overlay planes we claimed, when `atomic'
+
+      /// A buffer to show unscaled at `x', `y' on an overlay plane
+      struct overlay_t {
+        egl_buffer_t buffer;
+        int32_t      x, y;
+        uint32_t     width, height;
       };
-      uint32_t                               num_backbuffers;
-      std::atomic<uint32_t>                  current_backbuffer;
+      uint32_t num_backbuffers; ///< Swapchain depth, 3 lets a frame wait in line for the flip
       std::unordered_map<gbm_bo *, uint32_t> bo_to_fb;
-      egl_buffer_t                          *backbuffers;
-      gbm_bo                                *last_bo;
+      gbm_bo                                *last_bo; ///< Buffer object on the primary plane
+
+      // Page flips are asynchronous, `present' queues one and returns,
+      // the flip event is delivered through `handle_events', with the
+      // time and vblank sequence the new frame started scanning out.
+      // `async' tells whether the flip went through without waiting
+      // for vblank, `dropped' that the frame never reached the screen
+      // and the time is that of the frame still on it.
+      using flip_handler_t = std::function<void(
+        uint32_t sec, uint32_t usec, uint32_t sequence, bool async, bool dropped)>;
+      std::mutex              flip_mutex;
+      std::condition_variable flip_cv;
+      bool                    flip_pending; ///< A flip is queued and hasn't completed yet
+      bool primary_pending; ///< The queued flip replaces the buffer on the primary plane
+      bool                    pending_async; ///< The queued flip doesn't wait for vblank
+      bool overlays_active; ///< The overlay planes show something, as of the last flip
+      gbm_bo                 *pending_bo;   ///< Buffer object of the queued flip
+      std::vector<gbm_bo *> retired_bos; ///< No longer scanned out, released on the next acquire
+      flip_handler_t          on_flip;      ///< Completion handler of the queued flip
+
+      /// A rendered frame waiting for the pending flip to complete
+      struct queued_t {
+        gbm_bo                *bo;
+        uint32_t               fb;
+        std::vector<overlay_t> overlays;
+        bool                   async;
+        flip_handler_t         on_flip;
+      };
+      std::optional<queued_t> queued; ///< Only with `num_backbuffers' > 2
+
+      /// What our flip events point to, it stays put when we are moved
+      struct flip_target_t {
+        egl_t *egl; ///< nullptr once we are gone, late events are dropped
+      };
+      std::unique_ptr<flip_target_t> target;
+
+      gbm_bo  *cursor_bo;                   ///< Image on the cursor plane, created on first use
+      uint32_t cursor_width, cursor_height; ///< Size the cursor plane expects
 
       egl_t(drm::handle_t          &handle,
             const drm::connector_t &conn,
@@ -248,8 +390,129 @@ namespace minidrm {
       egl_buffer_t
       acquire();
 
+      /**
+       * Swap buffers and queue a page flip to them.  If the previous
+       * flip has not completed yet, the frame waits in line for it
+       * with a third backbuffer, otherwise we wait.  `on_flip' is invoked
+       * from `handle_events' with the vblank timestamp of the flip.
+       * With `async', the flip happens right away and may tear, if the
+       * driver supports it and no overlay planes are involved.
+       */
+      void
+      present(const egl_buffer_t           &buf,
+              flip_handler_t                on_flip  = nullptr,
+              const std::vector<overlay_t> &overlays = {},
+              bool                          async    = false);
+
+      /**
+       * Import a dmabuf of `num_planes' planes as a framebuffer for
+       * `present_direct'.  The returned buffer has `fb == 0', if it can
+       * not be scanned out.
+       */
+      egl_buffer_t
+      import(uint32_t        width,
+             uint32_t        height,
+             uint32_t        format,
+             uint32_t        num_planes,
+             const int      *fds,
+             const uint32_t *offsets,
+             const uint32_t *strides,
+             uint64_t        modifier);
+
+      /// Free a buffer returned by `import', it must not be on screen.
+      void
+      release(const egl_buffer_t &buf);
+
+      /**
+       * Flip to an imported buffer instead of our own backbuffers.
+       * Returns false without touching the screen, if the driver
+       * rejects the buffer.  `async' is the same as with `present'.
+       */
+      bool
+      present_direct(const egl_buffer_t &buf, flip_handler_t on_flip = nullptr, bool async = false);
+
+      /**
+       * Flip to whatever is on the primary plane already.  This only
+       * paces the display, with adaptive sync every flip starts a new
+       * refresh cycle.  Returns false if there is nothing to repeat.
+       */
+      bool
+      repeat(flip_handler_t on_flip = nullptr);
+
+      /**
+       * Let the refresh rate follow our flips (VRR_ENABLED), starting
+       * with the next one.  Returns false if the display can't.
+       */
+      bool
+      set_vrr(bool enable);
+
+      /**
+       * Ask the driver whether it can show `overlays' on our overlay
+       * planes, in order, along with what is on the primary plane.
+       */
+      bool
+      test_overlays(const std::vector<overlay_t> &overlays);
+
+      /**
+       * Flip only the overlay planes, the primary plane keeps its
+       * buffer.  Returns false without touching the screen, if the
+       * driver rejects the configuration.
+       */
+      bool
+      present_overlays(const std::vector<overlay_t> &overlays, flip_handler_t on_flip = nullptr);
+
+      /**
+       * Show `pixels' (premultiplied ARGB8888) on the cursor plane of
+       * our CRTC, or hide the cursor if `pixels' is nullptr.  Returns
+       * false when the driver has no cursor plane, or the image is
+       * larger than it.
+       */
+      bool
+      set_cursor(const uint32_t *pixels, uint32_t width, uint32_t height, uint32_t stride);
+
+      /**
+       * Move the top left corner of the cursor image to `x', `y'.
+       * This does not wait for a vblank.
+       */
+      bool
+      move_cursor(int32_t x, int32_t y);
+
+      /**
+       * Read and dispatch pending DRM events on `handle'.  Call this
+       * when the DRM fd becomes readable.
+       */
+      static void
+      handle_events(const drm::handle_t &handle);
+
+      private:
+      void
+      flipped(uint32_t sec, uint32_t usec, uint32_t sequence);
+
+      /// Hand buffers that left the screen back to GBM, call with
+      /// `flip_mutex' held from the render thread.
       void
-      present(const egl_buffer_t &buf);
+      release_retired();
+
+      /// Find the primary plane and property ids for atomic commits.
+      bool
+      init_atomic();
+
+      /// Scan out `fb' on the full primary plane.
+      void
+      set_plane(drm::atomic_t &, uint32_t fb) const;
+
+      /// Put `overlays' on our overlay planes, and disable the rest.
+      void
+      set_overlays(drm::atomic_t &, const std::vector<overlay_t> &overlays) const;
+
+      /**
+       * Queue a flip of the primary plane to `fb', with `overlays' on
+       * top.  An `async' flip is tried first, if possible, then a
+       * regular one.  With `test', the driver is asked beforehand and
+       * nothing is queued if it refuses.  Call with `flip_mutex' held.
+       */
+      int
+      flip(uint32_t fb, const std::vector<overlay_t> &overlays, bool async, bool test = false);
     };
 #endif
   };
@@ -270,6 +533,11 @@ namespace minidrm::drm {
     //   perror("drmSetMaster");
     // }
 
+    // Atomic mode setting needs universal planes, drivers that don't
+    // support it get the legacy SetCrtc/PageFlip path.
+    drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+    atomic = drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0;
+
     data = new handle_data_t;
 #if defined(MINIDRM_EGL) || defined(MINIDRM_VULKAN)
     data->gbm = gbm_create_device(fd);
@@ -292,6 +560,7 @@ namespace minidrm::drm {
     fd         = other.fd;
     references = other.references;
     data       = other.data;
+    atomic     = other.atomic;
 
     (*references)++;
     return *this;
@@ -306,7 +575,8 @@ namespace minidrm::drm {
     : card(other.card)
     , fd(other.fd)
     , references(other.references)
-    , data(other.data) {
+    , data(other.data)
+    , atomic(other.atomic) {
     // Increment the references
     (*references)++;
   }
@@ -371,12 +641,14 @@ namespace minidrm::drm {
     return result;
   }
 
-  crtc_t::crtc_t(uint32_t id, drmModeCrtc *ptr)
+  crtc_t::crtc_t(uint32_t id, uint32_t index, drmModeCrtc *ptr)
     : id(id)
+    , index(index)
     , crtc(ptr) {}
 
   crtc_t::crtc_t(const crtc_t &other)
     : id(other.id)
+    , index(other.index)
     , crtc(reinterpret_cast<drmModeCrtc *>(malloc(sizeof(drmModeCrtc)))) {
     memcpy(crtc, other.crtc, sizeof(*crtc));
   }
@@ -390,13 +662,122 @@ namespace minidrm::drm {
     std::vector<crtc_t> result;
     drmModeRes         *resources = drmModeGetResources(fd);
     for (int i = 0; i < resources->count_crtcs; ++i) {
-      result.emplace_back(crtc_t{ resources->crtcs[i], drmModeGetCrtc(fd, resources->crtcs[i]) });
+      result.emplace_back(
+        crtc_t{ resources->crtcs[i], (uint32_t)i, drmModeGetCrtc(fd, resources->crtcs[i]) });
     }
 
     drmModeFreeResources(resources);
     return result;
   }
 
+  std::vector<plane_t>
+  handle_t::planes() const {
+    std::vector<plane_t> result;
+    drmModePlaneRes     *resources = drmModeGetPlaneResources(fd);
+    if (!resources)
+      return result;
+
+    for (uint32_t i = 0; i < resources->count_planes; ++i) {
+      drmModePlane *plane = drmModeGetPlane(fd, resources->planes[i]);
+      if (!plane)
+        continue;
+
+      auto type = property(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type");
+      result.push_back(plane_t{ .id             = plane->plane_id,
+                                .possible_crtcs = plane->possible_crtcs,
+                                .type = type ? type->value : (uint64_t)DRM_PLANE_TYPE_OVERLAY });
+      drmModeFreePlane(plane);
+    }
+
+    drmModeFreePlaneResources(resources);
+    return result;
+  }
+
+  std::optional<property_t>
+  handle_t::property(uint32_t object, uint32_t type, const char *name) const {
+    drmModeObjectProperties *props = drmModeObjectGetProperties(fd, object, type);
+    if (!props)
+      return std::nullopt;
+
+    std::optional<property_t> result;
+    for (uint32_t i = 0; i < props->count_props && !result; ++i) {
+      drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+      if (!prop)
+        continue;
+
+      if (strcmp(prop->name, name) == 0)
+        result = property_t{ .id = prop->prop_id, .value = props->prop_values[i] };
+      drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(props);
+    return result;
+  }
+
+  std::vector<std::pair<uint32_t, uint64_t>>
+  handle_t::plane_formats(uint32_t plane) const {
+    std::vector<std::pair<uint32_t, uint64_t>> result;
+
+    auto in_formats = property(plane, DRM_MODE_OBJECT_PLANE, "IN_FORMATS");
+    if (drmModePropertyBlobRes *blob =
+          in_formats ? drmModeGetPropertyBlob(fd, in_formats->value) : nullptr;
+        blob) {
+      auto *header    = (const drm_format_modifier_blob *)blob->data;
+      auto *formats   = (const uint32_t *)((const char *)blob->data + header->formats_offset);
+      auto *modifiers = (const drm_format_modifier *)((const char *)blob->data +
+                                                      header->modifiers_offset);
+
+      // Every modifier applies to a window of 64 formats, starting at
+      // its `offset'.
+      for (uint32_t i = 0; i < header->count_modifiers; ++i) {
+        for (uint32_t bit = 0; bit < 64; ++bit) {
+          uint32_t index = modifiers[i].offset + bit;
+          if ((modifiers[i].formats & (1ull << bit)) && index < header->count_formats)
+            result.emplace_back(formats[index], modifiers[i].modifier);
+        }
+      }
+
+      drmModeFreePropertyBlob(blob);
+      return result;
+    }
+
+    drmModePlane *info = drmModeGetPlane(fd, plane);
+    if (!info)
+      return result;
+
+    for (uint32_t i = 0; i < info->count_formats; ++i)
+      result.emplace_back(info->formats[i], DRM_FORMAT_MOD_LINEAR);
+    drmModeFreePlane(info);
+    return result;
+  }
+
+  atomic_t::atomic_t(const handle_t &handle)
+    : drm(handle)
+    , request(drmModeAtomicAlloc()) {
+    if (!request)
+      throw std::runtime_error("drmModeAtomicAlloc failed");
+  }
+
+  atomic_t::~atomic_t() {
+    drmModeAtomicFree(request);
+  }
+
+  void
+  atomic_t::add(uint32_t object, uint32_t property, uint64_t value) {
+    if (drmModeAtomicAddProperty(request, object, property, value) < 0)
+      throw std::runtime_error("drmModeAtomicAddProperty failed");
+  }
+
+  bool
+  atomic_t::test(uint32_t flags) {
+    return drmModeAtomicCommit(drm.fd, request, flags | DRM_MODE_ATOMIC_TEST_ONLY, nullptr) == 0;
+  }
+
+  int
+  atomic_t::commit(uint32_t flags, void *user_data) {
+    return drmModeAtomicCommit(drm.fd, request, flags, user_data);
+  }
+
   std::vector<mode_t>
   connector_t::modes() const {
     std::vector<mode_t> result;
@@ -614,6 +995,28 @@ namespace minidrm::framebuffer {
   }
 
 #if defined(MINIDRM_EGL)
+  /**
+   * Overlay planes can often be used on several CRTCs, but only on one
+   * at a time.  Keep track of the ones an `egl_t' took.
+   */
+  static bool
+  claim_plane(const drm::handle_t &drm, uint32_t plane, bool claim) {
+    static std::mutex                             mutex;
+    static std::vector<std::pair<int, uint32_t>> claimed;
+
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = std::find(claimed.begin(), claimed.end(), std::pair{ drm.fd, plane });
+    if (!claim) {
+      if (it != claimed.end())
+        claimed.erase(it);
+      return true;
+    }
+    if (it != claimed.end())
+      return false;
+    claimed.emplace_back(drm.fd, plane);
+    return true;
+  }
+
   egl_t::egl_t(drm::handle_t          &drm_handle,
                const drm::connector_t &conn,
                const drm::crtc_t      &crtc,
@@ -623,8 +1026,22 @@ namespace minidrm::framebuffer {
     , connector(conn)
     , crtc(crtc)
     , mode(mode)
-    , num_backbuffers(bufs)
-    , current_backbuffer(0) {
+    , primary_plane(0)
+    , mode_blob(0)
+    , async_flip(false)
+    , vrr_capable(false)
+    , vrr(false)
+    , vrr_enabled(false)
+    , scanout_fb(0)
+    , num_backbuffers(std::clamp<uint32_t>(bufs, 2, 3))
+    , last_bo(nullptr)
+    , flip_pending(false)
+    , primary_pending(false)
+    , pending_async(false)
+    , overlays_active(false)
+    , pending_bo(nullptr)
+    , target(std::make_unique<flip_target_t>(this))
+    , cursor_bo(nullptr) {
 
     surface = gbm_surface_create(drm->gbm,
                                  mode.width(),
@@ -642,35 +1059,55 @@ namespace minidrm::framebuffer {
       throw std::runtime_error("Failed to create EGL surface");
     }
 
-    backbuffers = new egl_buffer_t[num_backbuffers];
-    for (int i = 0; i < num_backbuffers; ++i) {
-      backbuffers[i] = egl_buffer_t{
-        .bo = nullptr,
-        .fb = 0,
-      };
+    // A context is current on one thread at a time, and every output
+    // renders on its own. Share textures and programs with the device's.
+    const EGLint ctx_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    context =
+      eglCreateContext(drm->egl.display, drm->egl.config, drm->egl.context, ctx_attribs);
+    if (context == EGL_NO_CONTEXT) {
+      throw std::runtime_error("eglCreateContext failed");
     }
 
+    // Without EGL_EXT_buffer_age we can't know what the backbuffer
+    // holds, and callers have to redraw everything.
+    const char *extensions = eglQueryString(drm->egl.display, EGL_EXTENSIONS);
+    has_buffer_age = extensions && strstr(extensions, "EGL_EXT_buffer_age") != nullptr;
+
+    atomic = drm.atomic && init_atomic();
+
+    // Most hardware scans the cursor out at a fixed size, 64x64 if the
+    // driver doesn't tell us otherwise.
+    uint64_t cap;
+    cursor_width  = drmGetCap(drm.fd, DRM_CAP_CURSOR_WIDTH, &cap) == 0 ? cap : 64;
+    cursor_height = drmGetCap(drm.fd, DRM_CAP_CURSOR_HEIGHT, &cap) == 0 ? cap : 64;
+
+    // Atomic async flips are a lot younger than legacy ones.
+    async_flip = drmGetCap(drm.fd,
+                           atomic ? DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP : DRM_CAP_ASYNC_PAGE_FLIP,
+                           &cap) == 0 &&
+                 cap;
+
     // 8. Make context current & do an initial swap to render.
-    if (!eglMakeCurrent(drm->egl.display, egl_surface, egl_surface, drm->egl.context)) {
+    if (!eglMakeCurrent(drm->egl.display, egl_surface, egl_surface, context)) {
       throw std::runtime_error("Failed to eglMakeCurrent");
     }
     eglSwapBuffers(drm->egl.display, egl_surface);
 
-    // Provision the first FB id
-    gbm_bo *bo = backbuffers[0].bo = gbm_surface_lock_front_buffer(surface);
+    // Provision the first FB id, it stays locked for as long as
+    // `mode_set' shows it.
+    gbm_bo *bo = gbm_surface_lock_front_buffer(surface);
     if (!bo) {
       throw std::runtime_error("Failed to lock gbm surface");
     }
     uint32_t handle = gbm_bo_get_handle(bo).u32;
     uint32_t stride = gbm_bo_get_stride(bo);
-    int      ret =
-      drmModeAddFB(drm.fd, mode.width(), mode.height(), 24, 32, stride, handle, &backbuffers[0].fb);
+    int ret = drmModeAddFB(drm.fd, mode.width(), mode.height(), 24, 32, stride, handle, &scanout_fb);
     if (ret) {
       gbm_surface_release_buffer(surface, bo);
       throw std::runtime_error("egl_t::ctor drmModeAddFB failed");
     }
-    bo_to_fb[bo] = backbuffers[0].fb;
-    gbm_surface_release_buffer(surface, bo);
+    bo_to_fb[bo] = scanout_fb;
+    last_bo      = bo;
   }
 
   egl_t::egl_t(egl_t &&other)
@@ -681,29 +1118,312 @@ namespace minidrm::framebuffer {
 
     surface     = std::exchange(other.surface, nullptr);
     egl_surface = other.egl_surface;
-
+    context     = std::exchange(other.context, EGL_NO_CONTEXT);
+
+    has_buffer_age     = other.has_buffer_age;
+    atomic             = other.atomic;
+    primary_plane      = other.primary_plane;
+    mode_blob          = std::exchange(other.mode_blob, 0);
+    async_flip         = other.async_flip;
+    vrr_capable        = other.vrr_capable;
+    vrr                = other.vrr;
+    vrr_enabled        = other.vrr_enabled;
+    scanout_fb         = other.scanout_fb;
+    props              = other.props;
     num_backbuffers    = other.num_backbuffers;
-    current_backbuffer = other.current_backbuffer.load();
     bo_to_fb           = std::move(other.bo_to_fb);
-    backbuffers        = std::exchange(other.backbuffers, nullptr);
     last_bo            = std::exchange(other.last_bo, nullptr);
+
+    // A flip may be in flight, its event finds us through `target'.
+    std::lock_guard<std::mutex> guard(other.flip_mutex);
+    flip_pending    = std::exchange(other.flip_pending, false);
+    primary_pending = other.primary_pending;
+    pending_async   = other.pending_async;
+    overlays_active = other.overlays_active;
+    pending_bo      = std::exchange(other.pending_bo, nullptr);
+    retired_bos     = std::move(other.retired_bos);
+    on_flip         = std::move(other.on_flip);
+    queued          = std::exchange(other.queued, std::nullopt);
+    target          = std::move(other.target);
+    target->egl     = this;
+
+    overlay_planes = std::move(other.overlay_planes);
+
+    cursor_bo     = std::exchange(other.cursor_bo, nullptr);
+    cursor_width  = other.cursor_width;
+    cursor_height = other.cursor_height;
   }
 
   egl_t::~egl_t() {
-    delete[] backbuffers;
+    // Let the flip in flight, and the one queued after it, land first.
+    // Their events may as well be read by the wayland thread.
+    if (target) {
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+      std::unique_lock<std::mutex> lock(flip_mutex);
+      while ((flip_pending || queued) && std::chrono::steady_clock::now() < deadline) {
+        lock.unlock();
+        pollfd pfd = { .fd = drm.fd, .events = POLLIN, .revents = 0 };
+        if (poll(&pfd, 1, 100) > 0)
+          handle_events(drm);
+        lock.lock();
+      }
+
+      // The kernel still points at `target', it has to outlive us.
+      if (flip_pending)
+        target.release()->egl = nullptr;
+    }
+
+    for (auto const &plane : overlay_planes)
+      claim_plane(drm, plane.id, false);
+    if (mode_blob)
+      drmModeDestroyPropertyBlob(drm.fd, mode_blob);
+    if (cursor_bo)
+      gbm_bo_destroy(cursor_bo);
+    if (context != EGL_NO_CONTEXT) {
+      if (eglGetCurrentContext() == context)
+        eglMakeCurrent(drm->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+      eglDestroyContext(drm->egl.display, context);
+    }
+  }
+
+  bool
+  egl_t::set_cursor(const uint32_t *pixels, uint32_t width, uint32_t height, uint32_t stride) {
+    if (!pixels)
+      return drmModeSetCursor(drm.fd, crtc.id, 0, 0, 0) == 0;
+
+    if (width > cursor_width || height > cursor_height)
+      return false;
+
+    if (!cursor_bo) {
+      cursor_bo = gbm_bo_create(drm->gbm,
+                                cursor_width,
+                                cursor_height,
+                                GBM_FORMAT_ARGB8888,
+                                GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
+      if (!cursor_bo)
+        return false;
+    }
+
+    // The plane always scans out the full buffer, pad the image with
+    // transparent pixels.
+    std::vector<uint32_t> image(cursor_width * cursor_height, 0);
+    for (uint32_t y = 0; y < height; ++y) {
+      memcpy(&image[y * cursor_width],
+             reinterpret_cast<const uint8_t *>(pixels) + y * stride,
+             width * sizeof(uint32_t));
+    }
+
+    if (gbm_bo_write(cursor_bo, image.data(), image.size() * sizeof(uint32_t)))
+      return false;
+
+    return drmModeSetCursor(
+             drm.fd, crtc.id, gbm_bo_get_handle(cursor_bo).u32, cursor_width, cursor_height) == 0;
+  }
+
+  bool
+  egl_t::move_cursor(int32_t x, int32_t y) {
+    return drmModeMoveCursor(drm.fd, crtc.id, x, y) == 0;
+  }
+
+  bool
+  egl_t::init_atomic() {
+    for (auto const &plane : drm.planes()) {
+      if (plane.type == DRM_PLANE_TYPE_PRIMARY && (plane.possible_crtcs & (1 << crtc.index))) {
+        primary_plane = plane.id;
+        break;
+      }
+    }
+    if (!primary_plane)
+      return false;
+
+    auto lookup = [this](uint32_t object, uint32_t type, const char *name, uint32_t &id) {
+      auto prop = drm.property(object, type, name);
+      id        = prop ? prop->id : 0;
+      return id != 0;
+    };
+
+    const uint32_t conn = connector->connector_id;
+    bool ok = lookup(conn, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", props.connector_crtc_id) &&
+           lookup(crtc.id, DRM_MODE_OBJECT_CRTC, "MODE_ID", props.crtc_mode_id) &&
+           lookup(crtc.id, DRM_MODE_OBJECT_CRTC, "ACTIVE", props.crtc_active) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "FB_ID", props.plane_fb_id) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "CRTC_ID", props.plane_crtc_id) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "SRC_X", props.plane_src_x) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "SRC_Y", props.plane_src_y) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "SRC_W", props.plane_src_w) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "SRC_H", props.plane_src_h) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "CRTC_X", props.plane_crtc_x) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "CRTC_Y", props.plane_crtc_y) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "CRTC_W", props.plane_crtc_w) &&
+           lookup(primary_plane, DRM_MODE_OBJECT_PLANE, "CRTC_H", props.plane_crtc_h);
+    if (!ok)
+      return false;
+
+    // Adaptive sync needs both ends, the CRTC to time the flips and
+    // the sink to follow.
+    auto capable = drm.property(conn, DRM_MODE_OBJECT_CONNECTOR, "vrr_capable");
+    vrr_capable  = lookup(crtc.id, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED", props.crtc_vrr_enabled) &&
+                  capable && capable->value;
+
+    // Overlay planes are optional, take the ones that have everything
+    // we need and aren't driven by another CRTC.
+    for (auto const &plane : drm.planes()) {
+      if (plane.type != DRM_PLANE_TYPE_OVERLAY || !(plane.possible_crtcs & (1 << crtc.index)))
+        continue;
+
+      overlay_plane_t overlay{ .id = plane.id };
+      auto           &p = overlay.props;
+      if (!(lookup(plane.id, DRM_MODE_OBJECT_PLANE, "FB_ID", p.fb_id) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", p.crtc_id) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "SRC_X", p.src_x) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "SRC_Y", p.src_y) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "SRC_W", p.src_w) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "SRC_H", p.src_h) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "CRTC_X", p.crtc_x) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", p.crtc_y) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "CRTC_W", p.crtc_w) &&
+            lookup(plane.id, DRM_MODE_OBJECT_PLANE, "CRTC_H", p.crtc_h)))
+        continue;
+
+      if (claim_plane(drm, plane.id, true))
+        overlay_planes.push_back(overlay);
+    }
+    return true;
+  }
+
+  void
+  egl_t::set_plane(drm::atomic_t &req, uint32_t fb) const {
+    req.add(primary_plane, props.plane_fb_id, fb);
+    req.add(primary_plane, props.plane_crtc_id, crtc.id);
+    // Source coordinates are 16.16 fixed point
+    req.add(primary_plane, props.plane_src_x, 0);
+    req.add(primary_plane, props.plane_src_y, 0);
+    req.add(primary_plane, props.plane_src_w, (uint64_t)mode.width() << 16);
+    req.add(primary_plane, props.plane_src_h, (uint64_t)mode.height() << 16);
+    req.add(primary_plane, props.plane_crtc_x, 0);
+    req.add(primary_plane, props.plane_crtc_y, 0);
+    req.add(primary_plane, props.plane_crtc_w, mode.width());
+    req.add(primary_plane, props.plane_crtc_h, mode.height());
+  }
+
+  void
+  egl_t::set_overlays(drm::atomic_t &req, const std::vector<overlay_t> &overlays) const {
+    for (size_t i = 0; i < overlay_planes.size(); ++i) {
+      auto const &plane = overlay_planes[i];
+      if (i >= overlays.size()) {
+        req.add(plane.id, plane.props.fb_id, 0);
+        req.add(plane.id, plane.props.crtc_id, 0);
+        continue;
+      }
+
+      auto const &overlay = overlays[i];
+      req.add(plane.id, plane.props.fb_id, overlay.buffer.fb);
+      req.add(plane.id, plane.props.crtc_id, crtc.id);
+      req.add(plane.id, plane.props.src_x, 0);
+      req.add(plane.id, plane.props.src_y, 0);
+      req.add(plane.id, plane.props.src_w, (uint64_t)overlay.width << 16);
+      req.add(plane.id, plane.props.src_h, (uint64_t)overlay.height << 16);
+      req.add(plane.id, plane.props.crtc_x, overlay.x);
+      req.add(plane.id, plane.props.crtc_y, overlay.y);
+      req.add(plane.id, plane.props.crtc_w, overlay.width);
+      req.add(plane.id, plane.props.crtc_h, overlay.height);
+    }
+  }
+
+  int
+  egl_t::flip(uint32_t fb, const std::vector<overlay_t> &overlays, bool async, bool test) {
+    // Async flips may only swap the buffer on the primary plane, the
+    // overlay planes have to be off and stay off, and so does VRR.
+    pending_async =
+      async && async_flip && overlays.empty() && !overlays_active && vrr == vrr_enabled;
+
+    int ret = -1;
+    if (atomic) {
+      if (pending_async) {
+        drm::atomic_t req(drm);
+        req.add(primary_plane, props.plane_fb_id, fb);
+        if (!test || req.test(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_ASYNC))
+          ret = req.commit(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT |
+                             DRM_MODE_PAGE_FLIP_ASYNC,
+                           target.get());
+      }
+
+      // Drivers refuse async flips between buffers of different
+      // layouts, the next vblank will do then.
+      if (ret) {
+        pending_async = false;
+
+        drm::atomic_t req(drm);
+        req.add(primary_plane, props.plane_fb_id, fb);
+        req.add(primary_plane, props.plane_crtc_id, crtc.id);
+        set_overlays(req, overlays);
+        if (vrr_capable)
+          req.add(crtc.id, props.crtc_vrr_enabled, vrr);
+        if (test && !req.test(DRM_MODE_ATOMIC_NONBLOCK))
+          return -EINVAL;
+        ret = req.commit(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, target.get());
+        if (ret == 0)
+          vrr_enabled = vrr_capable && vrr;
+      }
+    } else {
+      if (pending_async)
+        ret = drmModePageFlip(drm.fd,
+                              crtc.id,
+                              fb,
+                              DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC,
+                              target.get());
+      if (ret) {
+        pending_async = false;
+        ret = drmModePageFlip(drm.fd, crtc.id, fb, DRM_MODE_PAGE_FLIP_EVENT, target.get());
+      }
+    }
+
+    if (ret == 0) {
+      overlays_active = !overlays.empty();
+      scanout_fb      = fb;
+    }
+    return ret;
+  }
+
+  void
+  egl_t::release_retired() {
+    for (auto bo : retired_bos)
+      gbm_surface_release_buffer(surface, bo);
+    retired_bos.clear();
   }
 
   egl_t::egl_buffer_t
   egl_t::acquire() {
-    if (!eglMakeCurrent(drm->egl.display, egl_surface, egl_surface, drm->egl.context)) {
+    if (!eglMakeCurrent(drm->egl.display, egl_surface, egl_surface, context)) {
       throw std::runtime_error("Failed to eglMakeCurrent");
     }
-    return egl_buffer_t{ .bo = nullptr, .fb = 0 };
+
+    // Every buffer of the swapchain is either on screen or on its way
+    // there, the next one frees up once the pending flip lands.
+    {
+      std::unique_lock<std::mutex> lock(flip_mutex);
+      flip_cv.wait(lock, [this] {
+        uint32_t locked = (last_bo != nullptr) + (pending_bo != nullptr) + queued.has_value();
+        return locked < num_backbuffers;
+      });
+      release_retired();
+    }
+
+    // The age tells the caller how many frames old the contents of
+    // the buffer we are about to draw into are.
+    EGLint age = 0;
+    if (has_buffer_age && !eglQuerySurface(drm->egl.display, egl_surface, EGL_BUFFER_AGE_EXT, &age))
+      age = 0;
+    return egl_buffer_t{ .bo = nullptr, .fb = 0, .age = age };
   }
 
   void
-  egl_t::present(const egl_buffer_t &buf) {
-    if (!eglMakeCurrent(drm->egl.display, egl_surface, egl_surface, drm->egl.context)) {
+  egl_t::present(const egl_buffer_t           &buf,
+                 flip_handler_t                on_flip,
+                 const std::vector<overlay_t> &overlays,
+                 bool                          async) {
+    if (!eglMakeCurrent(drm->egl.display, egl_surface, egl_surface, context)) {
       throw std::runtime_error("Failed to eglMakeCurrent");
     }
     eglSwapBuffers(drm->egl.display, egl_surface);
@@ -731,49 +1451,276 @@ namespace minidrm::framebuffer {
       bo_to_fb[bo] = fb_id;
     }
 
-    struct event_data {
-      std::atomic<bool> flip_done{ false };
-    };
-
-    auto ev_data       = new event_data;
-    ev_data->flip_done = false;
+    // Only one flip can be queued on a CRTC at a time.  Rendering the
+    // frame overlapped with the previous flip, with a spare buffer the
+    // frame waits in line and `flipped' queues it.  Otherwise we have
+    // to wait for the flip to land before we can queue ours.
+    std::unique_lock<std::mutex> lock(flip_mutex);
+    if (flip_pending && num_backbuffers > 2 && !queued) {
+      queued = queued_t{
+        .bo = bo, .fb = fb_id, .overlays = overlays, .async = async, .on_flip = std::move(on_flip)
+      };
+      return;
+    }
+    flip_cv.wait(lock, [this] { return !flip_pending; });
+    release_retired();
 
-    // Tell the DRM to flip our framebuffer
-    int ret = drmModePageFlip(drm.fd,
-                              crtc.id,
-                              fb_id,
-                              DRM_MODE_PAGE_FLIP_EVENT, // async, we'll wait later
-                              ev_data);
-    if (ret) {
+    // Tell the DRM to flip our framebuffer, the completion is
+    // delivered to `handle_events'.
+    if (flip(fb_id, overlays, async)) {
+      gbm_surface_release_buffer(surface, bo);
       throw std::runtime_error("drmModePageFlip failed");
     }
 
-    // Wait for the flip to be finished
-    drmEventContext evctx   = {};
-    evctx.version           = DRM_EVENT_CONTEXT_VERSION;
-    evctx.page_flip_handler = [](int fd, unsigned crtc, unsigned frame, unsigned sec, void *user) {
-      auto *data      = reinterpret_cast<decltype(ev_data)>(user);
-      data->flip_done = true;
+    flip_pending    = true;
+    primary_pending = true;
+    pending_bo      = bo;
+    this->on_flip   = std::move(on_flip);
+  }
+
+  egl_t::egl_buffer_t
+  egl_t::import(uint32_t        width,
+                uint32_t        height,
+                uint32_t        format,
+                uint32_t        num_planes,
+                const int      *fds,
+                const uint32_t *offsets,
+                const uint32_t *strides,
+                uint64_t        modifier) {
+    if (num_planes == 0 || num_planes > 4)
+      return egl_buffer_t{ .bo = nullptr, .fb = 0 };
+
+    gbm_import_fd_modifier_data data = {
+      .width    = width,
+      .height   = height,
+      .format   = format,
+      .num_fds  = num_planes,
+      .modifier = modifier,
     };
+    for (uint32_t i = 0; i < num_planes; ++i) {
+      data.fds[i]     = fds[i];
+      data.strides[i] = (int)strides[i];
+      data.offsets[i] = (int)offsets[i];
+    }
 
-    while (!ev_data->flip_done) {
-      drmHandleEvent(drm.fd, &evctx);
+    gbm_bo *bo = gbm_bo_import(drm->gbm, GBM_BO_IMPORT_FD_MODIFIER, &data, GBM_BO_USE_SCANOUT);
+    if (!bo)
+      return egl_buffer_t{ .bo = nullptr, .fb = 0 };
+
+    uint32_t handles[4]    = {};
+    uint32_t fb_strides[4] = {};
+    uint32_t fb_offsets[4] = {};
+    uint64_t modifiers[4]  = {};
+    for (uint32_t i = 0; i < num_planes; ++i) {
+      handles[i]    = gbm_bo_get_handle_for_plane(bo, i).u32;
+      fb_strides[i] = strides[i];
+      fb_offsets[i] = offsets[i];
+      modifiers[i]  = modifier;
     }
-    delete ev_data;
+    uint32_t fb_id = 0;
+
+    int ret = modifier == DRM_FORMAT_MOD_INVALID
+                ? drmModeAddFB2(
+                    drm.fd, width, height, format, handles, fb_strides, fb_offsets, &fb_id, 0)
+                : drmModeAddFB2WithModifiers(drm.fd,
+                                             width,
+                                             height,
+                                             format,
+                                             handles,
+                                             fb_strides,
+                                             fb_offsets,
+                                             modifiers,
+                                             &fb_id,
+                                             DRM_MODE_FB_MODIFIERS);
+    if (ret) {
+      gbm_bo_destroy(bo);
+      return egl_buffer_t{ .bo = nullptr, .fb = 0 };
+    }
+    return egl_buffer_t{ .bo = bo, .fb = fb_id };
+  }
 
-    // Release the last buffer
-    if (last_bo) {
-      gbm_surface_release_buffer(surface, last_bo);
+  void
+  egl_t::release(const egl_buffer_t &buf) {
+    if (buf.fb)
+      drmModeRmFB(drm.fd, buf.fb);
+    if (buf.bo)
+      gbm_bo_destroy(buf.bo);
+  }
+
+  bool
+  egl_t::present_direct(const egl_buffer_t &buf, flip_handler_t on_flip, bool async) {
+    std::unique_lock<std::mutex> lock(flip_mutex);
+    flip_cv.wait(lock, [this] { return !flip_pending; });
+    release_retired();
+
+    // The buffer covers the whole CRTC, nothing may sit on top.  The
+    // plane might not support its format or modifier, ask first.
+    if (flip(buf.fb, {}, async, true))
+      return false;
+
+    // The buffer isn't ours, there is nothing to hand back to GBM
+    // once it leaves the screen.
+    flip_pending    = true;
+    primary_pending = true;
+    pending_bo      = nullptr;
+    this->on_flip   = std::move(on_flip);
+    return true;
+  }
+
+  bool
+  egl_t::test_overlays(const std::vector<overlay_t> &overlays) {
+    if (overlays.empty())
+      return true;
+    if (!atomic || overlays.size() > overlay_planes.size())
+      return false;
+
+    drm::atomic_t req(drm);
+    set_overlays(req, overlays);
+    return req.test(DRM_MODE_ATOMIC_NONBLOCK);
+  }
+
+  bool
+  egl_t::present_overlays(const std::vector<overlay_t> &overlays, flip_handler_t on_flip) {
+    if (!atomic || overlays.size() > overlay_planes.size())
+      return false;
+
+    std::unique_lock<std::mutex> lock(flip_mutex);
+    flip_cv.wait(lock, [this] { return !flip_pending; });
+
+    drm::atomic_t req(drm);
+    set_overlays(req, overlays);
+    if (vrr_capable)
+      req.add(crtc.id, props.crtc_vrr_enabled, vrr);
+    if (req.commit(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, target.get()))
+      return false;
+    vrr_enabled = vrr_capable && vrr;
+
+    flip_pending    = true;
+    primary_pending = false;
+    pending_async   = false;
+    overlays_active = !overlays.empty();
+    this->on_flip   = std::move(on_flip);
+    return true;
+  }
+
+  bool
+  egl_t::repeat(flip_handler_t on_flip) {
+    if (!atomic)
+      return false;
+
+    std::unique_lock<std::mutex> lock(flip_mutex);
+    flip_cv.wait(lock, [this] { return !flip_pending; });
+    if (!scanout_fb)
+      return false;
+
+    // The same framebuffer again, the planes stay as they are.
+    drm::atomic_t req(drm);
+    req.add(primary_plane, props.plane_fb_id, scanout_fb);
+    if (vrr_capable)
+      req.add(crtc.id, props.crtc_vrr_enabled, vrr);
+    if (req.commit(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, target.get()))
+      return false;
+    vrr_enabled = vrr_capable && vrr;
+
+    flip_pending    = true;
+    primary_pending = false;
+    pending_async   = false;
+    this->on_flip   = std::move(on_flip);
+    return true;
+  }
+
+  bool
+  egl_t::set_vrr(bool enable) {
+    std::lock_guard<std::mutex> guard(flip_mutex);
+    vrr = enable && vrr_capable;
+    return vrr == enable;
+  }
+
+  void
+  egl_t::flipped(uint32_t sec, uint32_t usec, uint32_t sequence) {
+    flip_handler_t handler, dropped;
+    bool           async;
+    {
+      std::lock_guard<std::mutex> guard(flip_mutex);
+      // The previous front buffer is no longer scanned out, it is
+      // released by the render thread, GBM surfaces are not thread
+      // safe.
+      if (primary_pending) {
+        if (last_bo)
+          retired_bos.push_back(last_bo);
+        last_bo = std::exchange(pending_bo, nullptr);
+      }
+      flip_pending = false;
+      async        = pending_async;
+      handler      = std::move(on_flip);
+      on_flip      = nullptr;
+
+      // The next frame was already waiting in line.
+      if (queued) {
+        auto next = std::move(*queued);
+        queued.reset();
+        if (flip(next.fb, next.overlays, next.async) == 0) {
+          flip_pending    = true;
+          primary_pending = true;
+          pending_bo      = next.bo;
+          on_flip         = std::move(next.on_flip);
+        } else {
+          // It never makes it to the screen, but whoever waits for it
+          // must not wait forever.
+          retired_bos.push_back(next.bo);
+          dropped = std::move(next.on_flip);
+        }
+      }
+      // Under the lock, the destructor may be waiting for this flip
+      // and we must not touch `this' after it saw it land.
+      flip_cv.notify_all();
     }
-    last_bo = bo;
+
+    if (handler)
+      handler(sec, usec, sequence, async, false);
+    if (dropped)
+      dropped(sec, usec, sequence, async, true);
+  }
+
+  void
+  egl_t::handle_events(const drm::handle_t &handle) {
+    drmEventContext evctx   = {};
+    evctx.version           = DRM_EVENT_CONTEXT_VERSION;
+    evctx.page_flip_handler = [](int, unsigned frame, unsigned sec, unsigned usec, void *user) {
+      if (auto *egl = reinterpret_cast<flip_target_t *>(user)->egl; egl)
+        egl->flipped(sec, usec, frame);
+    };
+    drmHandleEvent(handle.fd, &evctx);
   }
 
   void
   egl_t::mode_set() {
+    if (atomic) {
+      if (!mode_blob &&
+          drmModeCreatePropertyBlob(drm.fd, &mode.mode, sizeof(mode.mode), &mode_blob)) {
+        throw std::runtime_error("Failed to create mode property blob");
+      }
+
+      drm::atomic_t req(drm);
+      req.add(connector->connector_id, props.connector_crtc_id, crtc.id);
+      req.add(crtc.id, props.crtc_mode_id, mode_blob);
+      req.add(crtc.id, props.crtc_active, 1);
+      set_plane(req, scanout_fb);
+
+      // Validate first, a rejected configuration must not leave the
+      // outputs half reconfigured.
+      if (!req.test(DRM_MODE_ATOMIC_ALLOW_MODESET))
+        throw std::runtime_error("Atomic mode set rejected by the driver");
+
+      if (req.commit(DRM_MODE_ATOMIC_ALLOW_MODESET))
+        throw std::runtime_error("Failed to mode set EGL buffer");
+      return;
+    }
+
     // Set CRTC to display the framebuffer
     int ret = drmModeSetCrtc(drm.fd,
                              crtc.id,
-                             backbuffers[current_backbuffer].fb,
+                             scanout_fb,
                              0,
                              0,
                              &connector->connector_id,
@@ -7,6 +7,9 @@
 #include "barock/core/wl_data_device_manager.hpp"
 #include "barock/core/wl_output.hpp"
 #include "barock/core/wl_seat.hpp"
+#include "barock/core/wp_presentation.hpp"
+#include "barock/core/wp_tearing_control.hpp"
+#include "barock/dmabuf/dmabuf.hpp"
 #include "barock/hotkey.hpp"
 #include "barock/render/opengl.hpp"
 #include "barock/resource.hpp"
@@ -67,6 +70,17 @@ compositor_t::compositor_t(minidrm::drm::handle_t drm_handle, const std::string
     },
     this);
 
+  // Page flips complete asynchronously, the render threads only
+  // queue them and the flip events are dispatched here.
+  registry_.event_loop->add_fd(
+    drm_handle.fd,
+    WL_EVENT_READABLE,
+    [](auto, auto, void *ud) -> int {
+      minidrm::framebuffer::egl_t::handle_events(reinterpret_cast<compositor_t *>(ud)->drm_handle);
+      return 0;
+    },
+    this);
+
   TRACE("* Initializing Cursor Manager");
   registry_.cursor = make_unique<cursor_manager_t>(registry_);
 
@@ -91,6 +105,15 @@ compositor_t::compositor_t(minidrm::drm::handle_t drm_handle, const std::string
   TRACE("* Initializing `wl_output` Protocol");
   registry_.wl_output = make_unique<wl_output_t>(display_, registry_);
 
+  TRACE("* Initializing `wp_presentation` Protocol");
+  registry_.wp_presentation = make_unique<wp_presentation_t>(display_, registry_);
+
+  TRACE("* Initializing `wp_tearing_control_manager_v1` Protocol");
+  registry_.wp_tearing_control = make_unique<wp_tearing_control_t>(display_, registry_);
+
+  TRACE("* Initializing `zwp_linux_dmabuf_v1` Protocol");
+  registry_.dmabuf = make_unique<dmabuf_t>(display_, registry_, drm_handle);
+
   TRACE("* Initializing XDG Shell Protocol");
   registry_.xdg_shell = make_unique<xdg_shell_t>(display_, registry_);
 
@@ -1,14 +1,20 @@
 #include "barock/core/cursor_manager.hpp"
 #include "barock/compositor.hpp"
+#include "barock/core/event_loop.hpp"
 #include "barock/core/input.hpp"
 #include "barock/core/output.hpp"
 #include "barock/core/renderer.hpp"
+#include "barock/core/shm_pool.hpp"
 #include "barock/core/signal.hpp"
+#include "barock/singleton.hpp"
+#include "barock/util.hpp"
 #include "jsl/optional.hpp"
+#include "wl/wayland-protocol.h"
 
 #include "../log.hpp"
 #include <X11/Xcursor/Xcursor.h>
 #include <cassert>
+#include <utility>
 #include <variant>
 
 using namespace barock;
@@ -80,7 +86,8 @@ const std::vector<std::string> CURSOR_NAMES = {
 };
 
 cursor_manager_t::cursor_manager_t(service_registry_t &registry)
-  : registry_(registry) {
+  : hardware_(false)
+  , registry_(registry) {
   registry.input->on_mouse_move.connect(
     std::bind(&cursor_manager_t::on_mouse_move, this, std::placeholders::_1));
 
@@ -104,14 +111,9 @@ cursor_manager_t::~cursor_manager_t() {
 
 signal_action_t
 cursor_manager_t::paint(output_t &output) {
-  fpoint_t screen = output.to<output_t::eWorkspace, output_t::eScreenspace>(position_);
-
-  // TODO: Damage tracking is implemented, but we can't draw partial
-  // regions yet.
-  //
-  // if (!output.damaged(position_.to<int>())) {
-  //   INFO("Skipping rendering cursor, region is not damaged.");
-  // }
+  // The display engine composites the cursor plane for us
+  if (hardware_)
+    return signal_action_t::eOk;
 
   std::visit(
     [&]<typename T>(T &texture) {
@@ -129,16 +131,154 @@ cursor_manager_t::paint(output_t &output) {
   return signal_action_t::eOk;
 }
 
+signal_action_t
+cursor_manager_t::scanout(output_t &, surface_t *&candidate) {
+  // A cursor we draw ourselves needs a composited frame to be drawn in
+  if (!hardware_)
+    candidate = nullptr;
+  return signal_action_t::eOk;
+}
+
+signal_action_t
+cursor_manager_t::overlay(output_t &, std::vector<plane_assignment_t> &candidates) {
+  if (hardware_)
+    return signal_action_t::eOk;
+
+  // We draw the cursor into the composited frame, which is below the
+  // overlay planes.
+  ipoint_t size{ 0, 0 };
+  if (auto image = std::get_if<XcursorImage *>(&texture_); image && *image)
+    size = ipoint_t{ (int)(*image)->width, (int)(*image)->height };
+  else if (auto surface = std::get_if<shared_t<surface_t>>(&texture_); surface && *surface)
+    size = (*surface)->full_extent();
+
+  region_t bounds{ top_left(), size };
+
+  std::erase_if(candidates,
+                [&bounds](auto const &candidate) { return candidate.bounds.intersects(bounds); });
+  return signal_action_t::eOk;
+}
+
+signal_action_t
+cursor_manager_t::present(output_t &output, const presentation_t &presentation) {
+  if (auto surface = cursor(); surface)
+    surface->frame_done(output, presentation);
+  return signal_action_t::eOk;
+}
+
+ipoint_t
+cursor_manager_t::top_left() const {
+  fpoint_t screen = output_->to<output_t::eWorkspace, output_t::eScreenspace>(position_);
+  if (auto image = std::get_if<XcursorImage *>(&texture_); image && *image)
+    return ipoint_t{ (int)screen.x - (int)(*image)->xhot, (int)screen.y - (int)(*image)->yhot };
+  return (screen - hotspot_).to<int>();
+}
+
+void
+cursor_manager_t::damage() const {
+  // Without a paint token we are not on any output yet, on the
+  // cursor plane, the scene underneath is untouched.
+  if (!paint_token_ || hardware_)
+    return;
+
+  std::visit(
+    [&]<typename T>(const T &texture) {
+      if (!texture)
+        return;
+
+      if constexpr (std::is_same_v<std::decay_t<decltype(texture)>, XcursorImage *>) {
+        output_->damage(region_t{
+          top_left(), ipoint_t{ (int)texture->width, (int)texture->height } });
+      } else {
+        // shared_t<surface_t>
+        output_->damage(region_t{ top_left(), texture->full_extent() });
+      }
+    },
+    texture_);
+}
+
+void
+cursor_manager_t::upload() {
+  if (!paint_token_)
+    return;
+
+  auto &renderer = output_->renderer();
+  bool  hardware = std::visit(
+    [&]<typename T>(T &texture) {
+      if (!texture)
+        return false;
+
+      if constexpr (std::is_same_v<std::decay_t<decltype(texture)>, XcursorImage *>) {
+        return renderer.cursor(
+          texture->pixels, { (int)texture->width, (int)texture->height }, texture->width * 4);
+      } else {
+        // shared_t<surface_t>, only plain ARGB shm buffers without
+        // subsurfaces can go onto the plane.
+        auto &buffer = texture->state.buffer;
+        if (!buffer || !buffer->pool || buffer->format != WL_SHM_FORMAT_ARGB8888 ||
+            !texture->stacking()->empty())
+          return false;
+
+        if (!renderer.cursor(reinterpret_cast<const uint32_t *>(buffer->data()),
+                             { buffer->width, buffer->height },
+                             buffer->stride))
+          return false;
+
+        // The plane has its own copy, and the new image is visible
+        // right away.  There is no flip to time it by, the callbacks
+        // go out from the wayland thread.
+        texture->copied(buffer);
+        if (texture->frame_pending()) {
+          texture->frame_drawn();
+          auto &event_loop = *singleton_t<compositor_t>::get().registry_.event_loop;
+          event_loop.defer([texture, output = output_, usec = current_time_usec()] {
+            texture->frame_done(*output, { .usec = usec });
+          });
+        }
+        return true;
+      }
+    },
+    texture_);
+
+  if (hardware)
+    renderer.move_cursor(top_left());
+  else if (hardware_)
+    renderer.cursor(nullptr, { 0, 0 }, 0);
+  hardware_ = hardware;
+}
+
 void
 cursor_manager_t::set_output(output_t *output) {
+  // Remove the cursor from the output we are leaving
+  damage();
+
+  if (hardware_) {
+    output_->renderer().cursor(nullptr, { 0, 0 }, 0);
+    hardware_ = false;
+  }
+
   if (paint_token_)
     output_->events.on_repaint[CURSOR_PAINT_LAYER].disconnect(paint_token_.value());
+  if (present_token_)
+    output_->events.on_present.disconnect(present_token_.value());
+  if (scanout_token_)
+    output_->events.on_scanout[CURSOR_PAINT_LAYER].disconnect(scanout_token_.value());
+  if (overlay_token_)
+    output_->events.on_overlay[CURSOR_PAINT_LAYER].disconnect(overlay_token_.value());
 
   if (output != nullptr) {
     // Update our output variable
     output_      = output;
     paint_token_ = output_->events.on_repaint[CURSOR_PAINT_LAYER].connect(
       std::bind(&cursor_manager_t::paint, this, std::placeholders::_1));
+    present_token_ = output_->events.on_present.connect(
+      std::bind(&cursor_manager_t::present, this, std::placeholders::_1, std::placeholders::_2));
+    scanout_token_ = output_->events.on_scanout[CURSOR_PAINT_LAYER].connect(
+      std::bind(&cursor_manager_t::scanout, this, std::placeholders::_1, std::placeholders::_2));
+    overlay_token_ = output_->events.on_overlay[CURSOR_PAINT_LAYER].connect(
+      std::bind(&cursor_manager_t::overlay, this, std::placeholders::_1, std::placeholders::_2));
+    upload();
+    damage();
   }
 }
 
@@ -191,6 +331,7 @@ cursor_manager_t::current_output() {
 
 void
 cursor_manager_t::xcursor(const char *name) {
+  damage();
   if (std::holds_alternative<XcursorImage *>(texture_)) {
     // First free the old one.
     XcursorImageDestroy(std::get<XcursorImage *>(texture_));
@@ -201,6 +342,8 @@ cursor_manager_t::xcursor(const char *name) {
   // on nullptr, we reset to left_ptr
   else
     texture_ = XcursorLibraryLoadImage("left_ptr", nullptr, 30);
+  upload();
+  damage();
 }
 
 shared_t<surface_t>
@@ -212,8 +355,26 @@ cursor_manager_t::cursor() const {
 
 void
 cursor_manager_t::set_cursor(shared_t<surface_t> surface, ipoint_t hotspot) {
+  damage();
+  if (auto old = cursor(); old && buffer_token_)
+    old->events.on_buffer_attach.disconnect(buffer_token_.value());
+  buffer_token_.invalidate();
+
   texture_ = surface;
   hotspot_ = hotspot;
+
+  // Follow the client updating its cursor image
+  if (surface) {
+    buffer_token_ = surface->events.on_buffer_attach.connect([this](auto &) {
+      damage();
+      upload();
+      damage();
+      return signal_action_t::eOk;
+    });
+  }
+
+  upload();
+  damage();
 }
 
 const fpoint_t &
@@ -223,7 +384,11 @@ cursor_manager_t::position() const {
 
 const fpoint_t &
 cursor_manager_t::position(const fpoint_t &value) {
+  damage();
   position_ = value;
+  damage();
+  if (hardware_)
+    output_->renderer().move_cursor(top_left());
   return position_;
 }
 
@@ -245,6 +410,9 @@ cursor_manager_t::on_mouse_move(mouse_event_t move) {
   // relative cursor position.
   double dx = 0., dy = 0.;
 
+  // Where the cursor was needs repainting as much as where it goes.
+  damage();
+
   // Calculate the delta the mouse moved.
   if (ty == LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE) {
     static double last_x = 0., last_y = 0.;
@@ -276,12 +444,6 @@ cursor_manager_t::on_mouse_move(mouse_event_t move) {
     dy = libinput_event_pointer_get_dy(move.pointer);
     position_.x += dx * 0.1;
     position_.y += dy * 0.1;
-    output_->damage(region_t{
-      fpoint_t{
-               output_->to<coordinate_space_t::eWorkspace, coordinate_space_t::eScreenspace>(position_) }
-        .to<int>(),
-      ipoint_t{                                        32,                                           32 }
-    });
   }
 
   direction_t transfer_direction = direction_t::eNone;
@@ -318,6 +480,10 @@ cursor_manager_t::on_mouse_move(mouse_event_t move) {
     }
   }
 
+  // On the cursor plane, moving the pointer is just a plane update
+  if (hardware_)
+    output_->renderer().move_cursor(top_left());
+  damage();
   return signal_action_t::eOk;
 }
 
@@ -333,5 +499,9 @@ cursor_manager_t::on_mouse_scroll(mouse_axis_t event) {
 
 void
 cursor_manager_t::set_cursor_position(const fpoint_t &position) {
+  damage();
   position_ = position;
+  damage();
+  if (hardware_)
+    output_->renderer().move_cursor(top_left());
 }
@@ -1,12 +1,66 @@
 #include "barock/core/event_loop.hpp"
+#include "../log.hpp"
+
+#include <cstring>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 using namespace barock;
 
 event_loop_t::event_loop_t(wl_event_loop *ev)
-  : event_loop_(ev) {}
+  : event_loop_(ev)
+  , thread_(std::this_thread::get_id())
+  , wakeup_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+  add_fd(wakeup_, WL_EVENT_READABLE, run_deferred, this);
+}
+
+event_loop_t::~event_loop_t() {
+  sources_.clear();
+  close(wakeup_);
+}
 
 void
 event_loop_t::add_fd(int fd, uint32_t mask, int (*func)(int32_t, uint32_t, void *), void *ud) {
   sources_.emplace_back(wl_event_loop_add_fd(event_loop_, fd, mask, func, ud),
                         wl_event_source_remove);
 }
+
+wl_event_source *
+event_loop_t::add_timer(int (*func)(void *), void *ud) {
+  return sources_
+    .emplace_back(wl_event_loop_add_timer(event_loop_, func, ud), wl_event_source_remove)
+    .get();
+}
+
+void
+event_loop_t::defer(std::function<void()> fn) {
+  if (std::this_thread::get_id() == thread_) {
+    fn();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    deferred_.push_back(std::move(fn));
+  }
+  uint64_t one = 1;
+  if (write(wakeup_, &one, sizeof(one)) != sizeof(one))
+    ERROR("Failed to wake up the event loop: {}", strerror(errno));
+}
+
+int
+event_loop_t::run_deferred(int32_t fd, uint32_t, void *ud) {
+  auto    *loop = static_cast<event_loop_t *>(ud);
+  uint64_t count;
+  if (read(fd, &count, sizeof(count)) != sizeof(count))
+    return 0;
+
+  std::vector<std::function<void()>> deferred;
+  {
+    std::lock_guard<std::mutex> guard(loop->mutex_);
+    deferred.swap(loop->deferred_);
+  }
+  for (auto &fn : deferred)
+    fn();
+  return 0;
+}
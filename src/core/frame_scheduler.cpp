@@ -0,0 +1,118 @@
+#include "barock/core/frame_scheduler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace barock;
+
+frame_scheduler_t::frame_scheduler_t()
+  : last_vblank_(0)
+  , in_flight_(0)
+  , paint_usec_(0.f)
+  , async_(false)
+  , follow_(false)
+  , ramp_usec_(0.f)
+  , ramp_step_(1.f)
+  , ramp_left_(0)
+  , ramp_due_(false) {}
+
+uint64_t
+frame_scheduler_t::timeout() const {
+  return ramp_usec_;
+}
+
+void
+frame_scheduler_t::idle() {
+  ramp_due_ = true;
+}
+
+bool
+frame_scheduler_t::take_repeat() {
+  return std::exchange(ramp_due_, false);
+}
+
+uint64_t
+frame_scheduler_t::start(uint64_t now, float rate) const {
+  uint64_t vblank = last_vblank_.load();
+  if (vblank == 0 || rate <= 0.f)
+    return now;
+
+  // A tearing client wants its frames out as soon as they are there,
+  // there is no vblank to wait for.  Neither is there one when the
+  // refresh rate follows a fullscreen client, or for a repeat.
+  if (async_ || follow_ || ramp_due_)
+    return now;
+
+  uint64_t period = 1000000.f / rate;
+  uint64_t budget = paint_usec_ + PAINT_MARGIN_USEC;
+  uint64_t next   = vblank + period * (1 + std::max(in_flight_.load(), 0));
+  if (next < now + budget)
+    next += (now + budget - next + period - 1) / period * period;
+  return std::max(next - budget, now);
+}
+
+bool
+frame_scheduler_t::frame(kms_t &kms, bool vrr, bool fullscreen, bool async, float rate) {
+  vrr     = kms.vrr(vrr) && vrr;
+  async_  = async;
+  follow_ = vrr && fullscreen;
+
+  // The ramp takes the same number of steps at any refresh rate, from
+  // the mode's interval to `VRR_RAMP_MAX_USEC'.  Below that rate there
+  // is nothing to ramp.
+  ramp_usec_ = 0.f;
+  ramp_left_ = 0;
+  if (vrr && !fullscreen && rate > 0.f) {
+    float period = 1000000.f / rate;
+    if (period < VRR_RAMP_MAX_USEC) {
+      ramp_step_ = std::pow(VRR_RAMP_MAX_USEC / period, 1.f / VRR_RAMP_STEPS);
+      ramp_usec_ = period * ramp_step_;
+      ramp_left_ = VRR_RAMP_STEPS;
+    }
+  }
+  return vrr;
+}
+
+bool
+frame_scheduler_t::repeat(kms_t &kms, present_handler_t on_presented) {
+  flipping();
+  if (!kms.repeat(std::move(on_presented))) {
+    dropped();
+    ramp_usec_ = 0.f;
+    ramp_left_ = 0;
+    return false;
+  }
+
+  // Each repeat comes a bit later than the previous one, the last one
+  // leaves the display at its lowest rate.
+  if (ramp_left_ == 0 || --ramp_left_ == 0)
+    ramp_usec_ = 0.f;
+  else
+    ramp_usec_ *= ramp_step_;
+  return true;
+}
+
+void
+frame_scheduler_t::flipping() {
+  in_flight_.fetch_add(1);
+}
+
+void
+frame_scheduler_t::dropped() {
+  in_flight_.fetch_sub(1);
+}
+
+void
+frame_scheduler_t::presented(const presentation_t &presentation) {
+  in_flight_.fetch_sub(1);
+  if (!presentation.discarded)
+    last_vblank_.store(presentation.usec);
+}
+
+void
+frame_scheduler_t::painted(uint64_t usec) {
+  // This is only what it costs us on the CPU, the GPU may still be
+  // busy, `PAINT_MARGIN_USEC' has to cover for that.
+  paint_usec_ = paint_usec_ == 0.f ? usec : 0.9f * paint_usec_ + 0.1f * usec;
+}
@@ -2,14 +2,22 @@
 
 #include "barock/core/output.hpp"
 #include "barock/core/renderer.hpp"
+#include "barock/core/shm_pool.hpp"
 #include "barock/util.hpp"
 #include "minidrm.hpp"
+#include "wl/presentation-time-protocol.h"
 
+#include <algorithm>
+#include <chrono>
+#include <drm_fourcc.h>
 #include <stdexcept>
+#include <utility>
 #include <xf86drmMode.h>
 
 using namespace barock;
 
+static thread_local output_t::frame_id_t painting_{ nullptr, 0 };
+
 mode_set_allocator_t::mode_set_allocator_t(minidrm::drm::handle_t handle)
   : handle_(handle)
   , taken_(0) {}
@@ -24,6 +32,7 @@ mode_set_allocator_t::adopt(const minidrm::drm::connector_t &connector) {
       ERROR("Failed to retrieve DRM encoder information about connector {}", connector.name());
       continue;
     }
+    possible_[connector.name()] |= encoder->possible_crtcs;
 
     auto crtcs = handle_.crtcs();
     for (int i = 0; i < crtcs.size(); ++i) {
@@ -46,16 +55,43 @@ mode_set_allocator_t::adopt(const minidrm::drm::connector_t &connector) {
 
 minidrm::framebuffer::egl_t
 mode_set_allocator_t::mode_set(const minidrm::drm::connector_t &connector,
-                               const minidrm::drm::mode_t      &mode) {
+                               const minidrm::drm::mode_t      &mode,
+                               uint32_t                         backbuffers) {
   if (!plan_.contains(connector.name()))
     throw std::runtime_error("Tried to `mode_set` a connector that wasn't adopted before!");
 
   auto crtcs = handle_.crtcs();
-  auto crtc  = crtcs[plan_[connector.name()]];
+  auto name  = connector.name();
+
+  // Try the planned CRTC first.  With atomic mode setting the driver
+  // validates the configuration up front, if it rejects it we fall
+  // back to any other free CRTC the connector can drive.
+  std::vector<size_t> candidates{ plan_[name] };
+  for (size_t i = 0; i < crtcs.size(); ++i) {
+    uint32_t bit = 1 << i;
+    if (i != plan_[name] && (possible_[name] & bit) && !(taken_ & bit))
+      candidates.push_back(i);
+  }
 
-  auto handle = minidrm::framebuffer::egl_t(handle_, connector, crtc, mode, 2);
-  handle.mode_set();
-  return std::move(handle);
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    try {
+      auto handle =
+        minidrm::framebuffer::egl_t(handle_, connector, crtcs[candidates[i]], mode, backbuffers);
+      handle.mode_set();
+
+      taken_ = (taken_ & ~(1 << plan_[name])) | (1 << candidates[i]);
+      plan_[name] = candidates[i];
+      return std::move(handle);
+    } catch (const std::runtime_error &error) {
+      if (i + 1 == candidates.size())
+        throw;
+      WARN("Mode set of {} on CRTC {} failed ({}), trying the next one.",
+           name,
+           crtcs[candidates[i]].id,
+           error.what());
+    }
+  }
+  throw std::runtime_error("No CRTC left to mode set on");
 }
 
 float
@@ -66,8 +102,16 @@ easing(float x) {
 
 output_t::output_t(const minidrm::drm::connector_t &connector, const minidrm::drm::mode_t &mode)
   : pan_({ 0.f, 0.f }, { 0.f, 0.f }, 1.f, easing)
-  , damage_(ipoint_t{ 0, 0 }, ipoint_t{ (int)mode.width(), (int)mode.height() })
+  , history_head_(0)
+  , history_size_(0)
   , force_render_(true)
+  , scanout_(false)
+  , tearing_(false)
+  , vrr_(false)
+  , backbuffers_(2)
+  , planes_dirty_(false)
+  , frame_requested_(false)
+  , frames_(0)
   , zoom_(1.f)
   , connector_(connector)
   , mode_(mode)
@@ -99,6 +143,11 @@ output_t::dirty_cv() const {
   return dirty_cv_;
 }
 
+output_t::frame_id_t
+output_t::painting() {
+  return painting_;
+}
+
 void
 output_t::force_render() const {
   std::lock_guard<std::recursive_mutex> guard(dirty_);
@@ -106,28 +155,104 @@ output_t::force_render() const {
   dirty_cv_.notify_all();
 }
 
+void
+output_t::frame_requested() const {
+  std::lock_guard<std::recursive_mutex> guard(dirty_);
+  frame_requested_ = true;
+  dirty_cv_.notify_all();
+}
+
+/**
+ * @brief Add `rect' to a list of damage rectangles, merging it with
+ * every rectangle it overlaps.  The renderer draws once per
+ * rectangle, overlapping rectangles would blend translucent surfaces
+ * twice.
+ */
+static void
+add_damage(std::vector<region_t> &rects, region_t rect, size_t max_rects) {
+  for (auto it = rects.begin(); it != rects.end();) {
+    if (it->intersects(rect)) {
+      rect = rect.union_with(*it);
+      rects.erase(it);
+      // The grown rectangle may now overlap ones we already checked.
+      it = rects.begin();
+    } else {
+      ++it;
+    }
+  }
+  rects.push_back(rect);
+
+  // Many small rectangles cost more in draw calls than they save in
+  // fill rate, fall back to their bounding box.
+  if (rects.size() > max_rects) {
+    region_t bounds = rects.front();
+    for (auto &other : rects)
+      bounds = bounds.union_with(other);
+    rects = { bounds };
+  }
+}
+
 void
 output_t::damage(const region_t &region) const {
+  // Only keep the part that is actually on this output
+  region_t rect = region - region_t{ 0, 0, (int32_t)mode_.width(), (int32_t)mode_.height() };
+  if (rect.w <= 0 || rect.h <= 0)
+    return;
+
   {
     std::lock_guard<std::recursive_mutex> guard(dirty_);
-    damage_.insert(node_t<int, void *>({ region.x, region.y }, nullptr));
-    damage_.insert(node_t<int, void *>({ region.x + region.w, region.y + region.h }, nullptr));
+    add_damage(damage_, rect, MAX_DAMAGE_RECTS);
   }
   dirty_cv_.notify_all();
 }
 
+void
+output_t::damage(const surface_t &surface, const region_t &region) const {
+  uint32_t now = current_time_msec();
+  {
+    std::lock_guard<std::recursive_mutex> guard(dirty_);
+
+    // Keep track of how the surface updates, for `assign_planes'
+    auto    &stats    = stats_[&surface];
+    ipoint_t extent   = surface.extent();
+    float    area     = (float)extent.x * extent.y;
+    float    coverage = area > 0.f ? std::min((float)region.w * region.h / area, 1.f) : 0.f;
+    if (stats.last_commit != 0)
+      stats.interval = 0.8f * stats.interval + 0.2f * (now - stats.last_commit);
+    stats.coverage    = 0.8f * stats.coverage + 0.2f * coverage;
+    stats.last_commit = now;
+
+    // The display engine shows the new buffer, we only have to flip
+    // the planes.
+    if (on_plane(surface)) {
+      planes_dirty_ = true;
+      dirty_cv_.notify_all();
+      return;
+    }
+  }
+  damage(region);
+}
+
 bool
-output_t::damaged(const ipoint_t &point) const {
+output_t::on_plane(const surface_t &surface) const {
   std::lock_guard<std::recursive_mutex> guard(dirty_);
-  return force_render_.load() || damage_.query(point, point + ipoint_t{ 1, 1 }).size() > 0;
+  return std::any_of(planes_.begin(), planes_.end(), [&surface](auto const &plane) {
+    return plane.surface == &surface;
+  });
+}
+
+bool
+output_t::damaged(const ipoint_t &point) const {
+  return std::any_of(repaint_.begin(), repaint_.end(), [&point](const region_t &rect) {
+    return rect.intersects(point.x, point.y);
+  });
 }
 
 bool
 output_t::damaged(const region_t &region) const {
-  std::lock_guard<std::recursive_mutex> guard(dirty_);
-  return force_render_.load() ||
-         damage_.query({ region.x, region.y }, { region.x + region.w, region.y + region.h })
-             .size() > 0;
+  return std::any_of(repaint_.begin(), repaint_.end(), [&region](const region_t &rect) {
+    return rect.intersects(region);
+  });
 }
 
 renderer_t &
@@ -251,22 +376,301 @@ output_t::pan(const fpoint_t &value, bool skip_animation) {
     pan_ = animation_t<fpoint_t>(pan_.sample(), value, 0.3f, easing);
     pan_.update(0.3f); // Skip to done
   }
+
+  // Panning moves everything on screen
+  force_render();
   return pan_.sample();
 }
 
+bool
+output_t::tearing() const {
+  return tearing_.load();
+}
+
+void
+output_t::tearing(bool allow) {
+  tearing_.store(allow);
+}
+
+uint32_t
+output_t::backbuffers() const {
+  return backbuffers_;
+}
+
+void
+output_t::backbuffers(uint32_t count) {
+  backbuffers_ = std::clamp<uint32_t>(count, 2, 3);
+}
+
+bool
+output_t::vrr() const {
+  return vrr_.load();
+}
+
+void
+output_t::vrr(bool enable) {
+  vrr_.store(enable);
+  force_render();
+}
+
+bool
+output_t::pending() const {
+  return !damage_.empty() || force_render_.load() || planes_dirty_ || frame_requested_;
+}
+
+void
+output_t::wait(std::unique_lock<std::recursive_mutex> &lock) {
+  // Damage may have come in while we were painting, unlocked
+  uint64_t timeout = scheduler_.timeout();
+  if (timeout == 0) {
+    dirty_cv_.wait(lock, [this] { return pending(); });
+    return;
+  }
+
+  // Repeats only go out on an idle output, new damage paints instead
+  if (!dirty_cv_.wait_for(lock, std::chrono::microseconds(timeout), [this] { return pending(); }))
+    scheduler_.idle();
+}
+
+void
+output_t::schedule(std::unique_lock<std::recursive_mutex> &lock) {
+  // Sleep through everything that is committed until we have to
+  // start, it all goes into a single frame.  The flip wait this leads
+  // into happens in paint, with `dirty' unlocked.
+  uint64_t now   = current_time_usec();
+  uint64_t start = scheduler_.start(now, mode_.refresh_rate());
+  if (start > now)
+    dirty_cv_.wait_for(lock, std::chrono::microseconds(start - now), [] { return false; });
+}
+
 void
 output_t::paint() {
-  uint32_t start = current_time_msec();
+  std::vector<region_t> frame;
+  bool                  planes_dirty;
+  bool                  repeat;
+  bool                  frame_only;
+  {
+    std::lock_guard<std::recursive_mutex> guard(dirty_);
+
+    // Panning moves everything, there is no point in tracking damage.
+    if (force_render_.load() || !pan_.is_done())
+      frame = { region_t{ 0, 0, (int32_t)mode_.width(), (int32_t)mode_.height() } };
+    else
+      frame = std::move(damage_);
+
+    damage_.clear();
+    force_render_.store(false);
+    planes_dirty = std::exchange(planes_dirty_, false);
+    repeat       = scheduler_.take_repeat();
+    frame_only   = std::exchange(frame_requested_, false);
+  }
+
+  if (frame.empty() && !planes_dirty && !repeat && !frame_only)
+    return;
+
+  // Surfaces drawn from here on are completed by this frame's flip.
+  painting_ = { this, ++frames_ };
+
+  uint32_t start        = current_time_msec();
+  auto     on_presented = [this, frame = painting_.number](const presentation_t &flip) {
+    presentation_t presentation = flip;
+    presentation.frame          = frame;
+    scheduler_.presented(presentation);
+
+    // The screen still shows the frame before, and the damage of this
+    // one went nowhere.
+    if (presentation.discarded)
+      force_render();
+    events.on_present.emit(*this, presentation);
+  };
+
+  // Nothing changed since the last frame, but the refresh rate is
+  // still on its way down.
+  if (frame.empty() && !planes_dirty && !frame_only) {
+    scheduler_.repeat(*renderer_, on_presented);
+    return;
+  }
+
+  // A surface covering the whole output can go to the screen as is,
+  // which spares us compositing the frame.
+  surface_t *candidate = nullptr;
+  for (auto &[_, signal] : events.on_scanout) {
+    signal.emit(*this, candidate);
+  }
+  // Only the client that has the whole screen gets to tear, anything
+  // else would tear other clients along with it.
+  bool async = tearing_.load() && candidate && candidate->state.tearing;
+  renderer_->tearing(async);
+  scheduler_.frame(*renderer_, vrr_.load(), candidate != nullptr, async, mode_.refresh_rate());
+
+  if (candidate) {
+    // Tells the client to allocate buffers the planes can take, see
+    // the dmabuf feedback.
+    candidate->offload_msec.store(start);
+
+    scheduler_.flipping();
+    if (renderer_->scanout(*candidate, on_presented)) {
+      scanout_ = true;
+      {
+        std::lock_guard<std::recursive_mutex> guard(dirty_);
+        planes_.clear();
+      }
+
+      uint32_t end = current_time_msec();
+      pan_.update((end - start) / 1000.f);
+      return;
+    }
+    scheduler_.dropped();
+  }
+
+  // Nothing we drew made it to the screen while scanning out, neither
+  // the damage history nor the backbuffers know what is on it.
+  if (std::exchange(scanout_, false)) {
+    history_size_ = 0;
+    frame         = { region_t{ 0, 0, (int32_t)mode_.width(), (int32_t)mode_.height() } };
+  }
+
+  // Surfaces that update often go onto overlay planes, the display
+  // engine puts them on top of the composited frame for us.
+  std::vector<plane_assignment_t> candidates;
+  for (auto &[_, signal] : events.on_overlay) {
+    signal.emit(*this, candidates);
+  }
+  // The wayland thread reads `planes_' and updates `stats_' as
+  // surfaces commit.  Nothing in here waits for a flip.
+  std::unique_lock<std::recursive_mutex> planes_lock(dirty_);
+  auto planes = assign_planes(std::move(candidates));
+
+  // Surfaces that left their plane have to be composited again.
+  for (auto const &previous : planes_) {
+    bool kept = std::any_of(planes.begin(), planes.end(), [&previous](auto const &current) {
+      return current.surface == previous.surface && current.bounds == previous.bounds;
+    });
+    if (!kept)
+      add_damage(frame, previous.bounds, MAX_DAMAGE_RECTS);
+  }
+  planes_ = planes;
+  planes_lock.unlock();
+
+  // We don't draw these, they are done as soon as they are on a plane.
+  for (auto const &plane : planes_) {
+    if (plane.surface->frame_pending())
+      plane.surface->frame_drawn(WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY);
+  }
+
+  // Only the overlay planes changed, the composited frame on screen is
+  // still good.  No need to touch the GPU at all.  A frame that was
+  // only asked for still goes through the repaint below, without
+  // damage of its own, so the surfaces waiting on it are drawn.
+  if (frame.empty() && !frame_only) {
+    scheduler_.flipping();
+    if (renderer_->commit_planes(on_presented)) {
+      uint32_t end = current_time_msec();
+      pan_.update((end - start) / 1000.f);
+      return;
+    }
+
+    scheduler_.dropped();
+    WARN("Updating the overlay planes failed, compositing them instead.");
+    renderer_->overlay({});
+    {
+      std::lock_guard<std::recursive_mutex> guard(dirty_);
+      planes_.clear();
+    }
+    frame = { region_t{ 0, 0, (int32_t)mode_.width(), (int32_t)mode_.height() } };
+  }
+
+  uint64_t paint_start = current_time_usec();
   renderer_->bind();
+
+  // The backbuffer we got still holds the frame from `age' frames
+  // ago, everything damaged since then is stale in it as well.  When
+  // the age is unknown, or older than our history, redraw it all.
+  size_t age = renderer_->buffer_age();
+  if (age == 0 || age - 1 > history_size_) {
+    repaint_ = { region_t{ 0, 0, (int32_t)mode_.width(), (int32_t)mode_.height() } };
+  } else {
+    repaint_ = frame;
+    for (size_t i = 0; i < age - 1; ++i) {
+      auto &past = history_[(history_head_ + MAX_BUFFER_AGE - i) % MAX_BUFFER_AGE];
+      for (auto &rect : past)
+        add_damage(repaint_, rect, MAX_DAMAGE_RECTS);
+    }
+  }
+
+  history_head_           = (history_head_ + 1) % MAX_BUFFER_AGE;
+  history_[history_head_] = std::move(frame);
+  history_size_           = std::min(history_size_ + 1, MAX_BUFFER_AGE);
+
+  renderer_->clip(repaint_);
   renderer_->clear(0.08f, 0.08f, 0.15f, 1.f);
   for (auto &[_, signal] : events.on_repaint) {
     signal.emit(*this);
   }
-  renderer_->commit();
+  // The flip completes asynchronously on the event loop, we can
+  // already start on the next frame.
+  scheduler_.flipping();
+  renderer_->commit(on_presented);
+
+  scheduler_.painted(current_time_usec() - paint_start);
 
   uint32_t end = current_time_msec();
   pan_.update((end - start) / 1000.f);
+}
+
+std::vector<plane_assignment_t>
+output_t::assign_planes(std::vector<plane_assignment_t> candidates) {
+  uint32_t now = current_time_msec();
+
+  // Statistics of surfaces that went quiet are useless, this also
+  // drops those of destroyed surfaces.
+  std::erase_if(stats_, [now](auto const &entry) {
+    return now - entry.second.last_commit > 10 * PLANE_IDLE_MSEC;
+  });
+
+  std::vector<std::pair<float, plane_assignment_t>> scored;
+  if (renderer_->planes() > 0) {
+    for (auto const &candidate : candidates) {
+      auto &buffer = candidate.surface->state.buffer;
+      if (!buffer || !buffer->dmabuf)
+        continue;
+
+      // GL samples YUV only through a conversion, if it can at all,
+      // these are always worth a plane.
+      float score = is_yuv(buffer->dmabuf->format) ? 1.f : 0.f;
+
+      // Each commit of a composited surface costs a frame, the more of
+      // it is damaged and the more often, the more a plane saves.
+      if (auto it = stats_.find(candidate.surface);
+          it != stats_.end() && now - it->second.last_commit < PLANE_IDLE_MSEC) {
+        float rate  = 1000.f / std::max(it->second.interval, 1.f);
+        score      += it->second.coverage * std::min(rate / 30.f, 1.f);
+      }
+
+      if (score >= PLANE_SCORE_MIN) {
+        candidate.surface->offload_msec.store(now);
+        scored.emplace_back(score, candidate);
+      }
+    }
+  }
+  std::stable_sort(
+    scored.begin(), scored.end(), [](auto const &a, auto const &b) { return a.first > b.first; });
+
+  // Add the candidates one by one, best first, and let the driver
+  // decide whether it can still do it.
+  std::vector<plane_assignment_t> planes;
+  for (auto const &[_, candidate] : scored) {
+    if (planes.size() == renderer_->planes())
+      break;
+
+    planes.push_back(candidate);
+    if (!renderer_->overlay(planes))
+      planes.pop_back();
+  }
 
-  force_render_.store(false);
-  damage_.clear();
+  // The renderer keeps the last accepted configuration, make sure
+  // that isn't one from an earlier frame.
+  if (planes.empty())
+    renderer_->overlay({});
+  return planes;
 }
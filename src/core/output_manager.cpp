@@ -46,7 +46,8 @@ output_manager_t::mode_set() {
           mode.width(),
           mode.height(),
           mode.refresh_rate());
-    output->renderer(gl_renderer_t{ mode, crtc_planner_.mode_set(output->connector_, mode) });
+    output->renderer(gl_renderer_t{
+      mode, crtc_planner_.mode_set(output->connector_, mode, output->backbuffers()) });
     events.on_mode_set.emit(*output);
   }
 }
@@ -58,8 +59,9 @@ output_manager_t::mode_set(output_t &output) {
         output.mode().width(),
         output.mode().height(),
         output.mode().refresh_rate());
-  output.renderer(
-    gl_renderer_t{ output.mode(), crtc_planner_.mode_set(output.connector(), output.mode()) });
+  output.renderer(gl_renderer_t{
+    output.mode(),
+    crtc_planner_.mode_set(output.connector(), output.mode(), output.backbuffers()) });
 
   events.on_mode_set.emit(output);
 }
@@ -1,9 +1,8 @@
 #include "barock/core/region.hpp"
-#include "../log.hpp"
-#include "barock/compositor.hpp"
 #include "barock/resource.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <wayland-server-core.h>
 
@@ -14,12 +13,23 @@ namespace barock {
     , w(w)
     , h(h) {}
 
+  region_t
+  region_t::clamped(int32_t x, int32_t y, int32_t w, int32_t h) {
+    constexpr int32_t LIMIT = 1 << 28;
+    return region_t{ std::clamp(x, -LIMIT, LIMIT),
+                     std::clamp(y, -LIMIT, LIMIT),
+                     std::clamp(w, 0, LIMIT),
+                     std::clamp(h, 0, LIMIT) };
+  }
+
   region_t
   region_t::operator+(const region_t &other) const {
-    return region_t{ std::min(x, other.x),
-                     std::min(y, other.y),
-                     std::max(other.x + other.w, x + w),
-                     std::max(other.y + other.h, y + h) };
+    // The bounding box of both, an empty side adds nothing to it
+    if (empty())
+      return other;
+    if (other.empty())
+      return *this;
+    return union_with(other);
   }
 
   void
@@ -77,6 +87,81 @@ namespace barock {
     return region_t{ new_x1, new_y1, new_x2 - new_x1, new_y2 - new_y1 };
   }
 
+  bool
+  region_t::empty() const {
+    return w <= 0 || h <= 0;
+  }
+
+  static int64_t
+  area(const region_t &region) {
+    return region.empty() ? 0 : (int64_t)region.w * region.h;
+  }
+
+  region_t
+  region_t::inner_union(const region_t &other) const {
+    if (empty())
+      return other;
+    if (other.empty())
+      return *this;
+
+    // One contains the other
+    if ((*this - other) == other)
+      return *this;
+    if ((other - *this) == *this)
+      return other;
+
+    // Two rectangles that line up, and touch or overlap, are the
+    // bounding box exactly.
+    bool columns = x == other.x && w == other.w && y <= other.y + other.h && other.y <= y + h;
+    bool rows    = y == other.y && h == other.h && x <= other.x + other.w && other.x <= x + w;
+    if (columns || rows)
+      return union_with(other);
+
+    // Anything else isn't a rectangle, keep the bigger part
+    return area(other) > area(*this) ? other : *this;
+  }
+
+  /**
+   * @brief The strips of `region' above, below, left and right of
+   * `cut', which lies inside of it.
+   */
+  static std::array<region_t, 4>
+  strips(const region_t &region, const region_t &cut) {
+    int32_t x2 = region.x + region.w, y2 = region.y + region.h;
+    return { region_t{ region.x, region.y, region.w, cut.y - region.y },
+             region_t{ region.x, cut.y + cut.h, region.w, y2 - cut.y - cut.h },
+             region_t{ region.x, region.y, cut.x - region.x, region.h },
+             region_t{ cut.x + cut.w, region.y, x2 - cut.x - cut.w, region.h } };
+  }
+
+  region_t
+  region_t::inner_subtract(const region_t &other) const {
+    region_t cut = *this - other;
+    if (empty() || cut.empty())
+      return *this;
+
+    region_t largest{ 0, 0, 0, 0 };
+    for (auto const &strip : strips(*this, cut))
+      if (area(strip) > area(largest))
+        largest = strip;
+    return largest;
+  }
+
+  region_t
+  region_t::outer_subtract(const region_t &other) const {
+    region_t cut = *this - other;
+    if (empty() || cut.empty())
+      return *this;
+
+    // Only a cut across the whole of one side shrinks the bounds
+    auto [top, bottom, left, right] = strips(*this, cut);
+    if (cut.x == x && cut.w == w)
+      return top + bottom;
+    if (cut.y == y && cut.h == h)
+      return left + right;
+    return *this;
+  }
+
   region_t region_t::infinite = { 0, 0, -1, -1 };
 }
 
@@ -87,8 +172,10 @@ wl_region_add(wl_client *,
               int32_t      y,
               int32_t      width,
               int32_t      height) {
-  barock::shared_t<barock::region_t> region = barock::from_wl_resource<barock::region_t>(wl_region);
-  *region                                   = *region + barock::region_t{ x, y, width, height };
+  auto region   = barock::from_wl_resource<barock::wl_region_data_t>(wl_region);
+  auto rect     = barock::region_t::clamped(x, y, width, height);
+  region->outer = region->outer + rect;
+  region->inner = region->inner.inner_union(rect);
 }
 
 void
@@ -98,9 +185,10 @@ wl_region_subtract(wl_client *,
                    int32_t      y,
                    int32_t      width,
                    int32_t      height) {
-
-  barock::shared_t<barock::region_t> region = barock::from_wl_resource<barock::region_t>(wl_region);
-  *region                                   = *region - barock::region_t{ x, y, width, height };
+  auto region   = barock::from_wl_resource<barock::wl_region_data_t>(wl_region);
+  auto rect     = barock::region_t::clamped(x, y, width, height);
+  region->outer = region->outer.outer_subtract(rect);
+  region->inner = region->inner.inner_subtract(rect);
 }
 
 void
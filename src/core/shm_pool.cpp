@@ -1,7 +1,17 @@
 #include "barock/core/shm_pool.hpp"
+#include "barock/compositor.hpp"
+#include "barock/core/event_loop.hpp"
 #include "barock/resource.hpp"
+#include "barock/singleton.hpp"
 #include "wl/wayland-protocol.h"
+#include <cstring>
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <linux/udmabuf.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
 
 #include "../log.hpp"
 #include <wayland-server-core.h>
@@ -33,6 +43,57 @@ struct wl_shm_pool_interface wl_shm_pool_impl = { .create_buffer = wl_shm_pool_c
                                                   .destroy       = wl_shm_pool_destroy,
                                                   .resize        = wl_shm_pool_resize };
 
+/**
+ * @brief Turn the pool memory behind `buffer' into a dmabuf through
+ * /dev/udmabuf, so the GPU can sample it without an upload.  Only
+ * works for memfd pools the client sealed against shrinking, with a
+ * page aligned buffer.  Leaves the buffer alone otherwise, it is
+ * copied then.
+ */
+static void
+export_udmabuf(shm_pool_t &pool, shm_buffer_t &buffer) {
+  static int udmabuf = [] {
+    int fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+      INFO("/dev/udmabuf is not available, shm buffers are copied: {}", strerror(errno));
+    return fd;
+  }();
+  static const long page_size = sysconf(_SC_PAGESIZE);
+
+  if (udmabuf < 0 || buffer.offset % page_size != 0)
+    return;
+
+  // udmabuf wants the pages pinned in place, which means the memfd
+  // must not shrink.  The seals are the client's to set, not ours.
+  // Anything but a memfd fails here.
+  int seals = fcntl(pool.fd, F_GET_SEALS);
+  if (seals < 0 || (seals & F_SEAL_WRITE) || !(seals & F_SEAL_SHRINK))
+    return;
+
+  uint64_t size = (uint64_t)buffer.stride * buffer.height;
+  size          = (size + page_size - 1) / page_size * page_size;
+
+  udmabuf_create create{ .memfd  = (uint32_t)pool.fd,
+                         .flags  = UDMABUF_FLAGS_CLOEXEC,
+                         .offset = (uint64_t)buffer.offset,
+                         .size   = size };
+  int dmabuf = ioctl(udmabuf, UDMABUF_CREATE, &create);
+  if (dmabuf < 0)
+    return;
+
+  // wl_shm formats are DRM fourccs, but for the two mandatory ones
+  uint32_t fourcc = buffer.format == WL_SHM_FORMAT_ARGB8888   ? DRM_FORMAT_ARGB8888
+                    : buffer.format == WL_SHM_FORMAT_XRGB8888 ? DRM_FORMAT_XRGB8888
+                                                              : buffer.format;
+  buffer.dmabuf = dmabuf_attributes_t{
+    .planes     = { dmabuf_attributes_t::plane_t{
+          .fd = dmabuf, .offset = 0, .stride = (uint32_t)buffer.stride } },
+    .num_planes = 1,
+    .format     = fourcc,
+    .modifier   = DRM_FORMAT_MOD_LINEAR,
+  };
+}
+
 void
 wl_shm_pool_create_buffer(wl_client   *client,
                           wl_resource *wl_shm_pool,
@@ -131,8 +192,75 @@ namespace barock {
     munmap(data, size);
   }
 
+  shm_buffer_t::~shm_buffer_t() {
+    if (!dmabuf)
+      return;
+    for (uint32_t i = 0; i < dmabuf->num_planes; ++i)
+      close(dmabuf->planes[i].fd);
+  }
+
   void *
   shm_buffer_t::data() {
     return (void *)(((uintptr_t)pool->data) + offset);
   }
+
+  void
+  shm_buffer_t::attached() {
+    if (std::exchange(exported, true) || !pool || dmabuf)
+      return;
+    export_udmabuf(*pool, *this);
+  }
+
+  uint32_t
+  shm_buffer_t::fourcc() const {
+    if (dmabuf)
+      return dmabuf->format;
+    return format == WL_SHM_FORMAT_ARGB8888   ? DRM_FORMAT_ARGB8888
+           : format == WL_SHM_FORMAT_XRGB8888 ? DRM_FORMAT_XRGB8888
+                                              : format;
+  }
+
+  buffer_ref_t::buffer_ref_t(shared_t<resource_t<shm_buffer_t>> buffer)
+    : buffer_(buffer) {
+    if (buffer_ && buffer_->busy.fetch_add(1) == 0)
+      buffer_->lent.fetch_add(1);
+  }
+
+  buffer_ref_t::buffer_ref_t(const buffer_ref_t &other)
+    : buffer_ref_t(other.buffer_) {}
+
+  buffer_ref_t::buffer_ref_t(buffer_ref_t &&other)
+    : buffer_(other.buffer_) {
+    // The reference moves over, `other' no longer drops it
+    other.buffer_ = {};
+  }
+
+  buffer_ref_t::~buffer_ref_t() {
+    if (!buffer_ || buffer_->busy.fetch_sub(1) != 1)
+      return;
+
+    // Render threads let go of buffers as well, the release waits for
+    // the event loop then.  Should the buffer be taken up again by
+    // then, whoever drops it last releases it.
+    auto &event_loop = *singleton_t<compositor_t>::get().registry_.event_loop;
+    event_loop.defer([buffer = buffer_, lent = buffer_->lent.load()] {
+      // A destroyed buffer has no one to go back to
+      if (buffer->busy.load() == 0 && buffer->lent.load() == lent && buffer->resource())
+        wl_buffer_send_release(buffer->resource());
+    });
+  }
+
+  buffer_ref_t &
+  buffer_ref_t::operator=(buffer_ref_t other) {
+    // `other' drops our old reference, once it goes out of scope
+    auto previous = buffer_;
+    buffer_       = other.buffer_;
+    other.buffer_ = previous;
+    return *this;
+  }
+
+  const shared_t<resource_t<shm_buffer_t>> &
+  buffer_ref_t::get() const {
+    return buffer_;
+  }
 };
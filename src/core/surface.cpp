@@ -2,15 +2,24 @@
 #include "barock/core/region.hpp"
 #include "barock/resource.hpp"
 
+#include "barock/core/event_loop.hpp"
+#include "barock/core/output.hpp"
+#include "barock/core/renderer.hpp"
 #include "barock/core/shm_pool.hpp"
 #include "barock/core/surface.hpp"
+#include "barock/core/wl_output.hpp"
 #include "barock/core/wl_subcompositor.hpp"
 
 #include "barock/shell/xdg_surface.hpp"
 #include "barock/shell/xdg_toplevel.hpp"
 #include "barock/shell/xdg_wm_base.hpp"
+#include "barock/singleton.hpp"
+#include "barock/util.hpp"
+
+#include "wl/presentation-time-protocol.h"
 
 #include "../log.hpp"
+#include <algorithm>
 #include <optional>
 #include <wayland-server-core.h>
 #include <wayland-server-protocol.h>
@@ -21,9 +30,11 @@ using namespace barock;
 
 namespace barock {
   surface_t::surface_t()
-    : state({ .subsurface = nullptr })
-    , staging({ .subsurface = nullptr })
-    , role(nullptr) {
+    : state{}
+    , staging{}
+    , role(nullptr)
+    , subsurface(nullptr)
+    , self_(std::make_shared<surface_t *>(this)) {
 
     // The initial value for an input region is infinite. That means
     // the whole surface will accept input.
@@ -31,9 +42,352 @@ namespace barock {
   }
 
   surface_t::surface_t(surface_t &&other)
-    : state(std::exchange(other.state, { .subsurface = nullptr }))
-    , staging(std::exchange(other.staging, { .subsurface = nullptr }))
-    , role(std::exchange(other.role, nullptr)) {}
+    : state(std::exchange(other.state, {}))
+    , staging(std::exchange(other.staging, {}))
+    , role(std::exchange(other.role, nullptr))
+    , subsurface(std::exchange(other.subsurface, nullptr))
+    , children(std::move(other.children))
+    , pending_children(std::move(other.pending_children))
+    , self_(std::make_shared<surface_t *>(this))
+    , stacking_(other.stacking()) {}
+
+  surface_t::~surface_t() {
+    events.on_destroy.emit(*this);
+
+    // Whatever wasn't presented yet, never will be.
+    std::vector<wl_resource *> discarded = std::move(state.feedback);
+    discarded.insert(discarded.end(), staging.feedback.begin(), staging.feedback.end());
+    discarded.insert(discarded.end(), cached_.feedback.begin(), cached_.feedback.end());
+    for (auto const &drawn : feedback_)
+      discarded.push_back(drawn.resource);
+    state.feedback.clear();
+    staging.feedback.clear();
+    cached_.feedback.clear();
+    feedback_.clear();
+
+    for (auto feedback : discarded) {
+      wp_presentation_feedback_send_discarded(feedback);
+      wl_resource_destroy(feedback);
+    }
+  }
+
+  uint32_t
+  surface_t::merge(surface_state_t &state, surface_state_t &pending) {
+    uint32_t                   dirty = std::exchange(pending.dirty, 0);
+    std::vector<wl_resource *> superseded;
+    {
+      // The render thread takes the callbacks of `state' as it draws.
+      std::lock_guard<std::mutex> guard(frame_mutex_);
+
+      // Frame callbacks of earlier commits that were not drawn yet,
+      // still wait for the next frame along with this commit's.
+      state.frames.insert(state.frames.end(), pending.frames.begin(), pending.frames.end());
+      pending.frames.clear();
+
+      // Feedback for the previous commit that never made it into a
+      // frame was superseded by this one.
+      superseded.swap(state.feedback);
+      state.feedback.swap(pending.feedback);
+    }
+
+    // Destroying the feedback calls back into `frame_forget'
+    for (auto feedback : superseded) {
+      wp_presentation_feedback_send_discarded(feedback);
+      wl_resource_destroy(feedback);
+    }
+    superseded.clear();
+    pending.feedback.swap(superseded);
+
+    if (dirty & surface_state_t::eOpaque)
+      state.opaque = pending.opaque;
+    if (dirty & surface_state_t::eInput)
+      state.input = pending.input;
+    if (dirty & surface_state_t::eTransform)
+      state.transform = pending.transform;
+    if (dirty & surface_state_t::eScale)
+      state.scale = pending.scale;
+    if (dirty & surface_state_t::eOffset)
+      state.offset = pending.offset;
+    if (dirty & surface_state_t::eTearing)
+      state.tearing = pending.tearing;
+
+    // Commits that are not applied yet add up their damage, `apply'
+    // moves it over to the history.
+    if (dirty & surface_state_t::eDamage) {
+      state.damage = state.damage ? state.damage->union_with(*pending.damage) : pending.damage;
+      pending.damage.reset();
+    }
+
+    // The buffer of the previous commit stays attached, unless a new
+    // one (or nullptr) was attached.
+    if (dirty & surface_state_t::eBuffer) {
+      state.buffer   = std::move(pending.buffer);
+      pending.buffer = nullptr;
+    }
+    return dirty;
+  }
+
+  bool
+  surface_t::synchronized() const {
+    surface_t const *candidate = this;
+    while (candidate->subsurface) {
+      if (candidate->subsurface->sync)
+        return true;
+
+      auto parent = candidate->subsurface->parent.lock();
+      if (!parent)
+        return false;
+      candidate = parent.get();
+    }
+    return false;
+  }
+
+  void
+  surface_t::commit() {
+    // The fast path, nothing to wait for
+    if (!has_cached_ && !synchronized()) {
+      apply(staging);
+      return;
+    }
+
+    // Synchronized commits add up until the parent commits.  Once the
+    // surface is desynchronized, they are applied as a whole.
+    cached_.dirty |= merge(cached_, staging);
+    has_cached_ = true;
+    if (!synchronized())
+      apply_cached();
+  }
+
+  void
+  surface_t::apply_cached() {
+    if (std::exchange(has_cached_, false))
+      apply(cached_);
+  }
+
+  void
+  surface_t::apply(surface_state_t &pending) {
+    ipoint_t before = extent();
+    uint32_t dirty  = merge(state, pending);
+
+    // Damage only becomes visible once the new state is applied, so
+    // outputs are told about it here rather than on `damage'.  The
+    // renderers pick up what to upload from the history.  Whatever
+    // clients damage outside of their buffer is of no interest.
+    if (dirty & surface_state_t::eDamage) {
+      region_t damaged = *state.damage - region_t{ ipoint_t{ 0, 0 }, extent() };
+      state.damage.reset();
+      {
+        std::lock_guard<std::mutex> guard(damage_mutex_);
+        damage_history_[++commits_ % DAMAGE_HISTORY] = damaged;
+      }
+      damage(damaged);
+    } else if (frame_pending())
+      root().events.on_frame.emit(*this);
+
+    // When set to nullptr, the compositor detaches the buffer and stops
+    // rendering that surface.  A buffer that went away or shrank leaves
+    // its old area behind on screen, that needs a repaint as well.
+    if (dirty & surface_state_t::eBuffer) {
+      state.hold     = buffer_ref_t{ state.buffer };
+      ipoint_t after = extent();
+      if (after.x != before.x || after.y != before.y)
+        damage({ ipoint_t{ 0, 0 },
+                 ipoint_t{ std::max(after.x, before.x), std::max(after.y, before.y) } });
+
+      if (state.buffer)
+        events.on_buffer_attach.emit(*state.buffer);
+      else
+        events.on_buffer_detach.emit(*this);
+    }
+
+    // Subsurfaces were added, moved or restacked, show them where they
+    // were and where they are now.
+    if (dirty & surface_state_t::eChildren) {
+      for (auto &child : children) {
+        if (auto surface = child.surface.lock(); surface)
+          surface->damage({ ipoint_t{ 0, 0 }, surface->extent() });
+      }
+
+      children.clear();
+      for (auto &child : pending_children) {
+        child.position = child.pending;
+        children.push_back(child);
+        if (auto surface = child.surface.lock(); surface)
+          surface->damage({ ipoint_t{ 0, 0 }, surface->extent() });
+      }
+      restack();
+    }
+
+    // Synchronized subsurfaces show their cached commits along with
+    // this one.
+    for (auto &child : children) {
+      if (auto surface = child.surface.lock(); surface)
+        surface->apply_cached();
+    }
+  }
+
+  void
+  surface_t::damage(const region_t &region) {
+    // Outputs only know about the root surface, which tells them
+    // where in the tree the damage is.
+    root().events.on_damage.emit(region, *this);
+  }
+
+  std::pair<region_t, uint64_t>
+  surface_t::damage_since(uint64_t commit) const {
+    std::lock_guard<std::mutex> guard(damage_mutex_);
+    if (commit > commits_ || commits_ - commit > DAMAGE_HISTORY)
+      return { region_t{ 0, 0, INT32_MAX, INT32_MAX }, commits_ };
+
+    region_t damage{ 0, 0, 0, 0 };
+    for (uint64_t i = commit + 1; i <= commits_; ++i)
+      damage = damage + damage_history_[i % DAMAGE_HISTORY];
+    return { damage, commits_ };
+  }
+
+  bool
+  surface_t::frame_pending() const {
+    std::lock_guard<std::mutex> guard(frame_mutex_);
+    return !state.frames.empty() || !state.feedback.empty();
+  }
+
+  void
+  surface_t::frame_drawn(uint32_t flags) {
+    auto [output, frame] = output_t::painting();
+
+    std::lock_guard<std::mutex> guard(frame_mutex_);
+    for (auto callback : state.frames)
+      frame_callbacks_.push_back({ .resource = callback, .output = output, .frame = frame });
+    state.frames.clear();
+    for (auto feedback : std::exchange(state.feedback, {}))
+      feedback_.push_back(
+        { .resource = feedback, .output = output, .frame = frame, .flags = flags });
+  }
+
+  void
+  surface_t::frame_done(output_t &output, const presentation_t &presentation) {
+    // Frames drawn after this one are still on their way, and other
+    // outputs count their own.  What was drawn outside of a paint, onto
+    // the cursor plane, is on screen already.
+    auto take = [&output, &presentation](std::vector<drawn_t> &drawn) {
+      auto later = std::stable_partition(drawn.begin(), drawn.end(), [&](auto const &d) {
+        return !d.output || (d.output == &output && d.frame <= presentation.frame);
+      });
+      std::vector<drawn_t> done(drawn.begin(), later);
+      drawn.erase(drawn.begin(), later);
+      return done;
+    };
+
+    std::vector<drawn_t> callbacks, feedback;
+    {
+      std::lock_guard<std::mutex> guard(frame_mutex_);
+      callbacks = take(frame_callbacks_);
+      feedback  = take(feedback_);
+    }
+
+    // Destroying the callback calls back into `frame_forget', which
+    // is why we don't hold the lock here.  A discarded frame still
+    // tells the client it's a good time to draw the next one.
+    for (auto const &callback : callbacks) {
+      wl_callback_send_done(callback.resource, presentation.msec());
+      wl_resource_destroy(callback.resource);
+    }
+
+    uint64_t sec  = presentation.usec / 1000000;
+    uint32_t nsec = presentation.usec % 1000000 * 1000;
+    for (auto [resource, _, frame, flags] : feedback) {
+      if (presentation.discarded) {
+        wp_presentation_feedback_send_discarded(resource);
+        wl_resource_destroy(resource);
+        continue;
+      }
+
+      // We only have a single `wl_output' global, whatever the client
+      // bound of it is where the frame was presented.
+      wl_client_for_each_resource(
+        wl_resource_get_client(resource),
+        [](wl_resource *resource, void *feedback) {
+          if (wl_resource_instance_of(resource, &wl_output_interface, &wl_output_impl))
+            wp_presentation_feedback_send_sync_output((wl_resource *)feedback, resource);
+          return WL_ITERATOR_CONTINUE;
+        },
+        resource);
+
+      wp_presentation_feedback_send_presented(resource,
+                                              sec >> 32,
+                                              sec & 0xffffffff,
+                                              nsec,
+                                              presentation.refresh,
+                                              0,
+                                              presentation.sequence,
+                                              presentation.flags | flags);
+      wl_resource_destroy(resource);
+    }
+
+    for (auto &child : children) {
+      if (auto subsurface = child.surface.lock(); subsurface)
+        subsurface->frame_done(output, presentation);
+    }
+  }
+
+  void
+  surface_t::frame_skip(uint32_t msec) {
+    std::vector<wl_resource *> callbacks, feedback;
+    {
+      std::lock_guard<std::mutex> guard(frame_mutex_);
+      callbacks.swap(state.frames);
+      feedback.swap(state.feedback);
+    }
+
+    for (auto callback : callbacks) {
+      wl_callback_send_done(callback, msec);
+      wl_resource_destroy(callback);
+    }
+
+    // Nothing of it was shown
+    for (auto resource : feedback) {
+      wp_presentation_feedback_send_discarded(resource);
+      wl_resource_destroy(resource);
+    }
+
+    for (auto &child : children) {
+      if (auto subsurface = child.surface.lock(); subsurface)
+        subsurface->frame_skip(msec);
+    }
+  }
+
+  void
+  surface_t::frame_forget(wl_resource *callback) {
+    // Callbacks move between these lists on both threads, see `merge'
+    // and `frame_drawn'.
+    std::lock_guard<std::mutex> guard(frame_mutex_);
+    std::erase(state.frames, callback);
+    std::erase(staging.frames, callback);
+    std::erase(cached_.frames, callback);
+    std::erase(state.feedback, callback);
+    std::erase(staging.feedback, callback);
+    std::erase(cached_.feedback, callback);
+
+    auto same = [callback](auto const &drawn) { return drawn.resource == callback; };
+    std::erase_if(frame_callbacks_, same);
+    std::erase_if(feedback_, same);
+  }
+
+  surface_t::stacking_t
+  surface_t::stacking() const {
+    std::lock_guard<std::mutex> guard(children_mutex_);
+    return stacking_;
+  }
+
+  void
+  surface_t::restack() {
+    auto snapshot = std::make_shared<std::vector<child_t>>();
+    for (auto &child : children)
+      snapshot->push_back({ .surface = child.surface, .position = child.position });
+
+    std::lock_guard<std::mutex> guard(children_mutex_);
+    stacking_ = std::move(snapshot);
+  }
 
   ipoint_t
   surface_t::extent() const {
@@ -43,21 +397,43 @@ namespace barock {
       return { state.buffer->width, state.buffer->height };
   }
 
+  void
+  surface_t::copied(shared_t<resource_t<shm_buffer_t>> buffer) {
+    // The hold is written as commits are applied, on the wayland
+    // thread.  That is where it is dropped as well.
+    auto &event_loop = *singleton_t<compositor_t>::get().registry_.event_loop;
+    event_loop.defer([self = std::weak_ptr(self_), buffer = std::move(buffer)] {
+      auto surface = self.lock();
+      if (surface && (*surface)->state.hold.get().get() == buffer.get())
+        (*surface)->state.hold = {};
+    });
+  }
+
+  region_t
+  surface_t::opaque_region() const {
+    region_t local{ ipoint_t{ 0, 0 }, extent() };
+    if (state.buffer && is_opaque(state.buffer->fourcc()))
+      return local;
+    return state.opaque - local;
+  }
+
   ipoint_t
   surface_t::full_extent() const {
     // Calculate the full extent of our surface, factoring in
-    // subsurfaces with negative offsets.
+    // subsurfaces with negative offsets.  Outputs ask for it while
+    // painting, the tree is walked through `stacking'.
     int min_x = 0, min_y = 0;
     int max_x = extent().x, max_y = extent().y;
 
     std::function<void(const surface_t &, int, int)> grow_bounds;
     grow_bounds = [&](const surface_t &surface, int offset_x, int offset_y) {
-      for (auto &child : surface.state.children) {
-        if (auto sub = child->surface.lock()) {
+      auto stacking = surface.stacking();
+      for (auto &child : *stacking) {
+        if (auto sub = child.surface.lock()) {
           // Absolute position of this child relative to our original
           // root
-          int abs_x = offset_x + child->position.x;
-          int abs_y = offset_y + child->position.y;
+          int abs_x = offset_x + child.position.x;
+          int abs_y = offset_y + child.position.y;
 
           // Current child's local buffer dimensions
           ipoint_t e = sub->extent();
@@ -84,15 +460,15 @@ namespace barock {
 
   ipoint_t
   surface_t::position() const {
-    if (!state.subsurface)
+    if (!subsurface)
       return { 0, 0 };
 
-    ipoint_t position{ state.subsurface->position };
-    auto     parent = state.subsurface->parent;
+    ipoint_t position{ subsurface->position };
+    auto     parent = subsurface->parent;
     while (auto surface = parent.lock()) {
-      if (surface->state.subsurface) {
-        position += surface->state.subsurface->position;
-        parent = surface->state.subsurface->parent;
+      if (surface->subsurface) {
+        position += surface->subsurface->position;
+        parent = surface->subsurface->parent;
       } else {
         // No more parent
         return position;
@@ -104,12 +480,12 @@ namespace barock {
   surface_t &
   surface_t::root() {
     surface_t *candidate = this;
-    if (!candidate->state.subsurface)
+    if (!candidate->subsurface)
       return *candidate;
 
-    while (auto surface = candidate->state.subsurface->parent.lock()) {
+    while (auto surface = candidate->subsurface->parent.lock()) {
       candidate = surface.get();
-      if (!candidate->state.subsurface)
+      if (!candidate->subsurface)
         return *candidate;
     }
     return *candidate;
@@ -118,12 +494,12 @@ namespace barock {
   const surface_t &
   surface_t::root() const {
     surface_t const *candidate = this;
-    if (!candidate->state.subsurface)
+    if (!candidate->subsurface)
       return *candidate;
 
-    while (auto surface = candidate->state.subsurface->parent.lock()) {
+    while (auto surface = candidate->subsurface->parent.lock()) {
       candidate = surface.get();
-      if (!candidate->state.subsurface)
+      if (!candidate->subsurface)
         return *candidate;
     }
     return *candidate;
@@ -133,9 +509,9 @@ namespace barock {
   surface_t::lookup(const ipoint_t &position) {
     shared_t<surface_t> surface = nullptr;
 
-    for (auto &child : state.children) {
-      if (auto subsurface = child->surface.lock(); subsurface) {
-        auto &child_position = subsurface->state.subsurface->position;
+    for (auto &child : children) {
+      if (auto subsurface = child.surface.lock(); subsurface) {
+        auto &child_position = child.position;
         // We can ignore subsurfaces that don't match our position
         if (child_position >= position)
           continue;
@@ -151,8 +527,8 @@ namespace barock {
     }
 
     auto dimensions = extent();
-    if (state.subsurface && position >= ipoint_t{ 0, 0 } && position <= dimensions)
-      return state.subsurface->surface.lock();
+    if (subsurface && position >= ipoint_t{ 0, 0 } && position <= dimensions)
+      return subsurface->surface.lock();
 
     return surface;
   }
@@ -165,8 +541,14 @@ wl_surface_damage(wl_client   *client,
                   int32_t      y,
                   int32_t      width,
                   int32_t      height) {
+  // TODO: Surface coordinates equal buffer coordinates for as long
+  // as we ignore the buffer scale & transform.
   auto surface = from_wl_resource<surface_t>(wl_surface);
-  surface->events.on_damage.emit(region_t{ x, y, width, height }, *surface);
+
+  auto  rect   = barock::region_t::clamped(x, y, width, height);
+  auto &damage = surface->staging.damage;
+  damage       = damage ? damage->union_with(rect) : rect;
+  surface->staging.dirty |= surface_state_t::eDamage;
 }
 
 void
@@ -179,37 +561,16 @@ wl_surface_damage_buffer(wl_client   *client,
   // TODO: Figure out the coordinate difference between `damage` and `damage_buffer`
   auto surface = from_wl_resource<surface_t>(wl_surface);
 
-  if (!surface->staging.damage)
-    surface->staging.damage = barock::region_t{ x, y, width, height };
-  else
-    surface->staging.damage =
-      surface->staging.damage->union_with(barock::region_t{ x, y, width, height });
-
-  surface->events.on_damage.emit(region_t{ x, y, width, height }, *surface);
+  auto  rect   = barock::region_t::clamped(x, y, width, height);
+  auto &damage = surface->staging.damage;
+  damage       = damage ? damage->union_with(rect) : rect;
+  surface->staging.dirty |= surface_state_t::eDamage;
 }
 
 void
 wl_surface_commit(wl_client *client, wl_resource *wl_surface) {
   auto surface = from_wl_resource<surface_t>(wl_surface);
-
-  barock::surface_state_t old_state = surface->state;
-  surface->state                    = surface->staging;
-
-  // Check whether the buffers changed, and the new buffer is not a
-  // nullptr, when set to nullptr, the compositor detaches the buffer
-  // and stops rendering that surface.
-  if (surface->state.buffer) {
-    surface->events.on_buffer_attach.emit(*surface->state.buffer);
-  }
-
-  surface->staging = barock::surface_state_t{ // By default, our surface has no pending damage.
-                                              .damage  = std::nullopt,
-                                              .pending = nullptr,
-
-                                              // Copy our subsurfaces, those are persistent
-                                              .subsurface = surface->state.subsurface,
-                                              .children   = surface->state.children
-  };
+  surface->commit();
 }
 
 void
@@ -225,7 +586,10 @@ wl_surface_destroy(wl_client *client, wl_resource *wl_surface) {
     return;
   }
 
+  // Whatever it showed has to go from the screen
+  ipoint_t extent       = surface->extent();
   surface->state.buffer = nullptr;
+  surface->damage({ ipoint_t{ 0, 0 }, extent });
 }
 
 void
@@ -239,11 +603,7 @@ wl_surface_frame(wl_client *client, wl_resource *wl_surface, uint32_t callback)
   wl_resource_set_implementation(callback_res, nullptr, weak, [](wl_resource *res) {
     auto weak_surface = (weak_t<resource_t<surface_t>> *)wl_resource_get_user_data(res);
     if (auto surface = weak_surface->lock(); surface) {
-      if (surface->state.pending == res) {
-        surface->state.pending = nullptr; // prevent dangling ptr
-      } else {
-        WARN("Tried to zero frame callback, but isn't owned by this resource");
-      }
+      surface->frame_forget(res); // prevent dangling ptr
     } else {
       WARN("wl_surface#on_destroy tried to get a strong reference to surface, but already out of "
            "scope.");
@@ -251,8 +611,8 @@ wl_surface_frame(wl_client *client, wl_resource *wl_surface, uint32_t callback)
     delete weak_surface;
   });
 
-  surface->state.pending   = callback_res;
-  surface->staging.pending = callback_res;
+  // Callbacks belong to the next commit
+  surface->staging.frames.push_back(callback_res);
 }
 
 void
@@ -263,15 +623,16 @@ wl_surface_attach(wl_client   *client,
                   int32_t      y) {
   auto surface = from_wl_resource<surface_t>(wl_surface);
 
+  // Buffers are double-buffered, a nullptr detaches the buffer with
+  // the next commit.
   if (wl_buffer == nullptr) {
     TRACE("wl_surface#attach: removing buffer from wl_surface");
     surface->staging.buffer = nullptr;
-    surface->state.buffer   = nullptr;
-    return;
+  } else {
+    surface->staging.buffer = from_wl_resource<shm_buffer_t>(wl_buffer);
+    surface->staging.buffer->attached();
   }
-
-  // Buffers are double-buffered
-  surface->staging.buffer = from_wl_resource<shm_buffer_t>(wl_buffer);
+  surface->staging.dirty |= surface_state_t::eBuffer;
 }
 
 void
@@ -279,13 +640,14 @@ wl_surface_set_opaque_region(wl_client *, wl_resource *wl_surface, wl_resource *
   auto surface = from_wl_resource<surface_t>(wl_surface);
 
   if (wl_region != nullptr) {
-    barock::region_t *region = (barock::region_t *)wl_resource_get_user_data(wl_region);
-    surface->staging.opaque  = *region;
+    auto region             = from_wl_resource<barock::wl_region_data_t>(wl_region);
+    surface->staging.opaque = region->inner;
   } else {
     // A NULL wl_region causes the pending opaque region to be set to
     // empty.
     surface->staging.opaque = barock::region_t{};
   }
+  surface->staging.dirty |= surface_state_t::eOpaque;
 }
 
 void
@@ -293,24 +655,27 @@ wl_surface_set_input_region(wl_client *, wl_resource *wl_surface, wl_resource *w
   auto surface = from_wl_resource<surface_t>(wl_surface);
 
   if (wl_region != nullptr) {
-    barock::region_t *region = (barock::region_t *)wl_resource_get_user_data(wl_region);
-    surface->staging.input   = *region;
+    auto region            = from_wl_resource<barock::wl_region_data_t>(wl_region);
+    surface->staging.input = region->outer;
   } else {
     // A NULL wl_region causes the input region to be set to infinite.
-    surface->staging.opaque = barock::region_t::infinite;
+    surface->staging.input = barock::region_t::infinite;
   }
+  surface->staging.dirty |= surface_state_t::eInput;
 }
 
 void
 wl_surface_set_buffer_transform(wl_client *, wl_resource *wl_surface, int32_t transform) {
   auto surface               = from_wl_resource<surface_t>(wl_surface);
   surface->staging.transform = transform;
+  surface->staging.dirty |= surface_state_t::eTransform;
 }
 
 void
 wl_surface_set_buffer_scale(wl_client *, wl_resource *wl_surface, int32_t scale) {
   auto surface           = from_wl_resource<surface_t>(wl_surface);
   surface->staging.scale = scale;
+  surface->staging.dirty |= surface_state_t::eScale;
 }
 
 void
@@ -318,6 +683,7 @@ wl_surface_offset(wl_client *, wl_resource *wl_surface, int32_t x, int32_t y) {
   auto surface              = from_wl_resource<surface_t>(wl_surface);
   surface->staging.offset.x = x;
   surface->staging.offset.y = y;
+  surface->staging.dirty |= surface_state_t::eOffset;
 }
 
 struct wl_surface_interface wl_surface_impl = { .destroy           = wl_surface_destroy,
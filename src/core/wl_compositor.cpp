@@ -50,6 +50,6 @@ wl_compositor_create_surface(wl_client *client, wl_resource *wl_compositor, uint
 
 void
 wl_compositor_create_region(wl_client *client, wl_resource *wl_compositor, uint32_t id) {
-  make_resource<region_t>(
+  make_resource<wl_region_data_t>(
     client, wl_region_interface, wl_region_impl, wl_resource_get_version(wl_compositor), id);
 }
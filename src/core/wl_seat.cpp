@@ -475,13 +475,13 @@ dump_tree(surface_t &surface, int indent = 2) {
     indent_str.push_back(' ');
   }
 
-  if (surface.state.subsurface)
-    std::cout << indent_str << surface.state.subsurface->position.x << ", "
-              << surface.state.subsurface->position.y << " (" << surface.extent().x << "x"
+  if (surface.subsurface)
+    std::cout << indent_str << surface.subsurface->position.x << ", "
+              << surface.subsurface->position.y << " (" << surface.extent().x << "x"
               << surface.extent().y << ")\n";
 
-  for (auto child : surface.state.children) {
-    dump_tree(*child->surface.lock(), indent + 2);
+  for (auto &child : surface.children) {
+    dump_tree(*child.surface.lock(), indent + 2);
   }
 }
 
@@ -10,6 +10,8 @@
 
 #include "../log.hpp"
 
+#include <cassert>
+#include <utility>
 #include <wayland-server-core.h>
 #include <wayland-server-protocol.h>
 
@@ -28,9 +30,71 @@ struct wl_subcompositor_interface wl_subcompositor_impl{
 
 void
 wl_subsurface_set_position(wl_client *client, wl_resource *wl_subsurface, int32_t x, int32_t y) {
-  auto subsurface        = from_wl_resource<subsurface_t>(wl_subsurface);
-  subsurface->position.x = x;
-  subsurface->position.y = y;
+  auto subsurface       = from_wl_resource<subsurface_t>(wl_subsurface);
+  subsurface->pending.x = x;
+  subsurface->pending.y = y;
+
+  // Applied with the next commit of the parent
+  if (auto parent = subsurface->parent.lock(); parent)
+    parent->staging.dirty |= surface_state_t::eChildren;
+}
+
+/**
+ * @brief Restack the subsurface right above or below `sibling', which
+ * is either another subsurface of the same parent or the parent itself.
+ */
+static void
+wl_subsurface_place(wl_resource *wl_subsurface, wl_resource *wl_sibling, bool above) {
+  auto subsurface = from_wl_resource<subsurface_t>(wl_subsurface);
+  auto parent     = subsurface->parent.lock();
+  auto sibling    = from_wl_resource<surface_t>(wl_sibling);
+  if (!parent)
+    return;
+
+  auto &children = parent->pending_children;
+  if (sibling.get() == parent.get()) {
+    // Subsurfaces are always stacked above their parent, the closest
+    // we get to either is the bottom of the stack.
+    children.erase(*subsurface);
+    children.insert(children.head, *subsurface);
+  } else if (sibling->subsurface && sibling->subsurface.get() != subsurface.get() &&
+             sibling->subsurface->parent.lock().get() == parent.get()) {
+    auto &other = *sibling->subsurface;
+    children.erase(*subsurface);
+    children.insert(above ? other.pending_link.next : &other, *subsurface);
+  } else {
+    wl_resource_post_error(wl_subsurface,
+                           WL_SUBSURFACE_ERROR_BAD_SURFACE,
+                           "Surface is neither a sibling nor the parent.");
+    return;
+  }
+
+  // Applied with the next commit of the parent
+  parent->staging.dirty |= surface_state_t::eChildren;
+}
+
+void
+wl_subsurface_place_above(wl_client *, wl_resource *wl_subsurface, wl_resource *sibling) {
+  wl_subsurface_place(wl_subsurface, sibling, true);
+}
+
+void
+wl_subsurface_place_below(wl_client *, wl_resource *wl_subsurface, wl_resource *sibling) {
+  wl_subsurface_place(wl_subsurface, sibling, false);
+}
+
+void
+wl_subsurface_set_sync(wl_client *, wl_resource *wl_subsurface) {
+  auto subsurface  = from_wl_resource<subsurface_t>(wl_subsurface);
+  subsurface->sync = true;
+}
+
+void
+wl_subsurface_set_desync(wl_client *, wl_resource *wl_subsurface) {
+  // The cached state is applied with the next commit of the surface
+  // itself, unless a parent is still synchronized.
+  auto subsurface  = from_wl_resource<subsurface_t>(wl_subsurface);
+  subsurface->sync = false;
 }
 
 void
@@ -39,14 +103,94 @@ wl_subsurface_destroy(wl_client *, wl_resource *);
 struct wl_subsurface_interface wl_subsurface_impl{
   .destroy      = wl_subsurface_destroy,
   .set_position = wl_subsurface_set_position,
-  .place_above  = nullptr,
-  .place_below  = nullptr,
-  .set_sync     = [](auto, auto) {},
-  .set_desync   = [](auto, auto) {},
+  .place_above  = wl_subsurface_place_above,
+  .place_below  = wl_subsurface_place_below,
+  .set_sync     = wl_subsurface_set_sync,
+  .set_desync   = wl_subsurface_set_desync,
 };
 
 namespace barock {
 
+  subsurface_t::~subsurface_t() {
+    unlink();
+  }
+
+  void
+  subsurface_t::unlink() {
+    if (link.list) {
+      link.list->erase(*this);
+      if (auto surface = parent.lock(); surface)
+        surface->restack();
+    }
+    if (pending_link.list)
+      pending_link.list->erase(*this);
+  }
+
+  subsurface_list_t::subsurface_list_t(subsurface_link_t subsurface_t::*link)
+    : link(link) {}
+
+  subsurface_list_t::subsurface_list_t(subsurface_list_t &&other)
+    : link(other.link)
+    , head(std::exchange(other.head, nullptr))
+    , tail(std::exchange(other.tail, nullptr)) {
+    for (auto &subsurface : *this)
+      (subsurface.*link).list = this;
+  }
+
+  subsurface_list_t::~subsurface_list_t() {
+    // The subsurfaces may outlive their parent
+    clear();
+  }
+
+  void
+  subsurface_list_t::push_back(subsurface_t &subsurface) {
+    insert(nullptr, subsurface);
+  }
+
+  void
+  subsurface_list_t::insert(subsurface_t *above, subsurface_t &subsurface) {
+    auto &node = subsurface.*link;
+    assert(node.list == nullptr && "Subsurface is linked already");
+    node.list = this;
+    node.next = above;
+    node.prev = above ? (above->*link).prev : tail;
+
+    if (node.prev)
+      (node.prev->*link).next = &subsurface;
+    else
+      head = &subsurface;
+
+    if (above)
+      (above->*link).prev = &subsurface;
+    else
+      tail = &subsurface;
+  }
+
+  void
+  subsurface_list_t::erase(subsurface_t &subsurface) {
+    auto &node = subsurface.*link;
+    if (node.list != this)
+      return;
+
+    if (node.prev)
+      (node.prev->*link).next = node.next;
+    else
+      head = node.next;
+
+    if (node.next)
+      (node.next->*link).prev = node.prev;
+    else
+      tail = node.prev;
+
+    node = {};
+  }
+
+  void
+  subsurface_list_t::clear() {
+    while (head)
+      erase(*head);
+  }
+
   wl_subcompositor_t::wl_subcompositor_t(wl_display *display, service_registry_t &registry)
     : display(display)
     , registry(registry) {
@@ -116,14 +260,11 @@ wl_subcompositor_get_subsurface(wl_client   *client,
   // the parent (see wl_surface.commit). The effect of adding a
   // sub-surface becomes visible on the next time the state of the
   // parent surface is applied.
-  // TODO: Not implemented yet.
-
-  parent_surface->state.children.push_back(wl_subsurface);
-  parent_surface->staging.children.push_back(wl_subsurface);
+  parent_surface->pending_children.push_back(*wl_subsurface);
+  parent_surface->staging.dirty |= surface_state_t::eChildren;
 
   // We immediately add the parent to the state of our child_surface.
-  child_surface->state.subsurface   = wl_subsurface;
-  child_surface->staging.subsurface = wl_subsurface;
+  child_surface->subsurface = wl_subsurface;
 
   // The parent surface must not be one of the child surface's
   // descendants, and the parent must be different from the child
@@ -139,29 +280,13 @@ void
 wl_subsurface_destroy(wl_client *, wl_resource *wl_subsurface) {
   auto subsurface = from_wl_resource<subsurface_t>(wl_subsurface);
 
-  // if (auto surface = subsurface->surface.lock()) {
-  //   auto parent = surface->parent.lock();
-
-  //   // TODO: We "double"-buffer the subsurfaces, therefore we also have
-  //   // to remove the subsurface from both buffers, this sucks.
-
-  //   { // Active
-  //     auto begin = parent->state.children.begin();
-  //     auto end   = parent->state.children.begin();
-
-  //     auto it = std::find(begin, end, subsurface);
-  //     if (it != end) {
-  //       parent->state.children.erase(it);
-  //     }
-  //   }
-  //   { // Inactive (staging)
-  //     auto begin = parent->staging.children.begin();
-  //     auto end   = parent->staging.children.begin();
-
-  //     auto it = std::find(begin, end, subsurface);
-  //     if (it != end) {
-  //       parent->staging.children.erase(it);
-  //     }
-  //   }
-  // }
+  // The surface is unmapped right away, and nothing is left to wait
+  // for the parent.
+  if (auto surface = subsurface->surface.lock(); surface) {
+    surface->damage({ ipoint_t{ 0, 0 }, surface->extent() });
+    subsurface->unlink();
+    surface->subsurface = nullptr;
+    surface->apply_cached();
+  }
+  wl_resource_destroy(wl_subsurface);
 }
@@ -0,0 +1,70 @@
+#include "barock/core/wp_presentation.hpp"
+#include "barock/compositor.hpp"
+#include "barock/core/surface.hpp"
+#include "barock/resource.hpp"
+
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+#include <time.h>
+
+using namespace barock;
+
+void
+wp_presentation_destroy(wl_client *, wl_resource *wp_presentation) {
+  wl_resource_destroy(wp_presentation);
+}
+
+void
+wp_presentation_feedback(wl_client   *client,
+                         wl_resource *wp_presentation,
+                         wl_resource *wl_surface,
+                         uint32_t     id) {
+  auto surface = from_wl_resource<surface_t>(wl_surface);
+  auto weak    = new weak_t<resource_t<surface_t>>(surface);
+
+  wl_resource *feedback = wl_resource_create(
+    client, &wp_presentation_feedback_interface, wl_resource_get_version(wp_presentation), id);
+  if (!feedback) {
+    delete weak;
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  wl_resource_set_implementation(feedback, nullptr, weak, [](wl_resource *res) {
+    // Feedback outlives its surface only to deliver `discarded', there
+    // is nothing left to forget about then.
+    auto weak_surface = (weak_t<resource_t<surface_t>> *)wl_resource_get_user_data(res);
+    if (auto surface = weak_surface->lock(); surface)
+      surface->frame_forget(res);
+    delete weak_surface;
+  });
+
+  // Feedback belongs to the next commit, like frame callbacks.
+  surface->staging.feedback.push_back(feedback);
+}
+
+struct wp_presentation_interface wp_presentation_impl{
+  .destroy  = wp_presentation_destroy,
+  .feedback = wp_presentation_feedback,
+};
+
+barock::wp_presentation_t::wp_presentation_t(wl_display *display, service_registry_t &registry)
+  : display(display)
+  , registry(registry) {
+  wp_presentation_global =
+    wl_global_create(display, &wp_presentation_interface, VERSION, this, bind);
+}
+
+void
+barock::wp_presentation_t::bind(wl_client *client, void *ud, uint32_t version, uint32_t id) {
+  wl_resource *presentation = wl_resource_create(client, &wp_presentation_interface, version, id);
+  if (!presentation) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(presentation, &wp_presentation_impl, ud, nullptr);
+
+  // Flip timestamps come from the kernel in CLOCK_MONOTONIC
+  wp_presentation_send_clock_id(presentation, CLOCK_MONOTONIC);
+}
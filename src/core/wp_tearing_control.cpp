@@ -0,0 +1,96 @@
+#include "barock/core/wp_tearing_control.hpp"
+#include "barock/compositor.hpp"
+#include "barock/core/surface.hpp"
+#include "barock/resource.hpp"
+
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+using namespace barock;
+
+void
+wp_tearing_control_set_presentation_hint(wl_client *, wl_resource *tearing_control, uint32_t hint) {
+  auto weak_surface = (weak_t<resource_t<surface_t>> *)wl_resource_get_user_data(tearing_control);
+
+  // Inert once the surface is gone
+  if (auto surface = weak_surface->lock(); surface) {
+    surface->staging.tearing = hint == WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC;
+    surface->staging.dirty |= surface_state_t::eTearing;
+  }
+}
+
+void
+wp_tearing_control_destroy(wl_client *, wl_resource *tearing_control) {
+  wl_resource_destroy(tearing_control);
+}
+
+struct wp_tearing_control_v1_interface wp_tearing_control_impl{
+  .set_presentation_hint = wp_tearing_control_set_presentation_hint,
+  .destroy               = wp_tearing_control_destroy,
+};
+
+void
+wp_tearing_control_manager_destroy(wl_client *, wl_resource *manager) {
+  wl_resource_destroy(manager);
+}
+
+void
+wp_tearing_control_manager_get_tearing_control(wl_client   *client,
+                                               wl_resource *manager,
+                                               uint32_t     id,
+                                               wl_resource *wl_surface) {
+  auto  surface = from_wl_resource<surface_t>(wl_surface);
+  auto &control = surface->metadata.ensure<tearing_control_t>();
+  if (control.resource) {
+    wl_resource_post_error(manager,
+                           WP_TEARING_CONTROL_MANAGER_V1_ERROR_TEARING_CONTROL_EXISTS,
+                           "Surface already has a tearing control object.");
+    return;
+  }
+
+  wl_resource *resource = wl_resource_create(
+    client, &wp_tearing_control_v1_interface, wl_resource_get_version(manager), id);
+  if (!resource) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  auto weak = new weak_t<resource_t<surface_t>>(surface);
+  wl_resource_set_implementation(resource, &wp_tearing_control_impl, weak, [](wl_resource *res) {
+    auto weak_surface = (weak_t<resource_t<surface_t>> *)wl_resource_get_user_data(res);
+
+    // Destroying the object reverts the hint to vsync, with the next
+    // commit.
+    if (auto surface = weak_surface->lock(); surface) {
+      surface->metadata.get<tearing_control_t>().resource = nullptr;
+      surface->staging.tearing                            = false;
+      surface->staging.dirty |= surface_state_t::eTearing;
+    }
+    delete weak_surface;
+  });
+  control.resource = resource;
+}
+
+struct wp_tearing_control_manager_v1_interface wp_tearing_control_manager_impl{
+  .destroy             = wp_tearing_control_manager_destroy,
+  .get_tearing_control = wp_tearing_control_manager_get_tearing_control,
+};
+
+barock::wp_tearing_control_t::wp_tearing_control_t(wl_display         *display,
+                                                   service_registry_t &registry)
+  : display(display)
+  , registry(registry) {
+  wp_tearing_control_global =
+    wl_global_create(display, &wp_tearing_control_manager_v1_interface, VERSION, this, bind);
+}
+
+void
+barock::wp_tearing_control_t::bind(wl_client *client, void *ud, uint32_t version, uint32_t id) {
+  wl_resource *manager =
+    wl_resource_create(client, &wp_tearing_control_manager_v1_interface, version, id);
+  if (!manager) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(manager, &wp_tearing_control_manager_impl, ud, nullptr);
+}
@@ -1,17 +1,232 @@
 #include "barock/dmabuf/buffer.hpp"
+#include "barock/core/shm_pool.hpp"
+#include "barock/dmabuf/dmabuf.hpp"
+#include "barock/dmabuf/params.hpp"
+#include "barock/resource.hpp"
 
 #include "../log.hpp"
+#include <bit>
+#include <drm_fourcc.h>
+#include <gbm.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+
+using namespace barock;
+
+/**
+ * @brief The planes a client added so far, owned by the params object
+ * until `create' hands them to the buffer.
+ */
+struct linux_buffer_params_t : public dmabuf_params_t {
+  const dmabuf_formats_t &formats;
+  gbm_device             *gbm;
+
+  linux_buffer_params_t(const dmabuf_formats_t &formats, gbm_device *gbm)
+    : formats(formats)
+    , gbm(gbm) {}
+
+  ~linux_buffer_params_t() {
+    for (uint32_t i = 0; i < dmabuf_attributes_t::MAX_PLANES; ++i)
+      if (added & (1 << i))
+        close(planes[i].fd);
+  }
+};
+
+void
+linux_buffer_params_destroy(wl_client *, wl_resource *params) {
+  wl_resource_destroy(params);
+}
+
+void
+linux_buffer_params_add(wl_client   *client,
+                        wl_resource *resource,
+                        int32_t      fd,
+                        uint32_t     plane_idx,
+                        uint32_t     offset,
+                        uint32_t     stride,
+                        uint32_t     modifier_hi,
+                        uint32_t     modifier_lo) {
+  auto    *params   = (linux_buffer_params_t *)wl_resource_get_user_data(resource);
+  uint64_t modifier = ((uint64_t)modifier_hi << 32) | modifier_lo;
+
+  // One buffer, one layout.  Enforced since version 5.
+  bool same_modifier = wl_resource_get_version(resource) >= 5;
+  if (auto error = params->add(fd, plane_idx, offset, stride, modifier, same_modifier)) {
+    close(fd);
+    wl_resource_post_error(resource, error->code, "%s", error->message.c_str());
+  }
+}
+
+/**
+ * @brief Check the params of `create' and `create_immed', and mark
+ * them used.  Returns false after posting a protocol error.
+ */
+static bool
+validate(wl_resource *resource, int32_t width, int32_t height, uint32_t format) {
+  auto *params = (linux_buffer_params_t *)wl_resource_get_user_data(resource);
+
+  // Since version 4 clients only get to use what we advertised
+  bool advertised =
+    wl_resource_get_version(resource) < ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION ||
+    params->formats.supported(format, params->modifier);
+  if (auto error = params->check(width, height, format, advertised)) {
+    wl_resource_post_error(resource, error->code, "%s", error->message.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Try to import the planes of validated params, so a buffer the
+ * GPU can't read fails now instead of drawing nothing later.
+ */
+static bool
+importable(linux_buffer_params_t *params, int32_t width, int32_t height, uint32_t format) {
+  // Older clients aren't held to the advertised formats, but we can't
+  // draw anything else.
+  if (!params->formats.supported(format, params->modifier))
+    return false;
+
+  gbm_import_fd_modifier_data data = {
+    .width    = (uint32_t)width,
+    .height   = (uint32_t)height,
+    .format   = format,
+    .num_fds  = (uint32_t)std::countr_one(params->added),
+    .modifier = params->modifier,
+  };
+  for (uint32_t i = 0; i < data.num_fds; ++i) {
+    data.fds[i]     = params->planes[i].fd;
+    data.strides[i] = (int)params->planes[i].stride;
+    data.offsets[i] = (int)params->planes[i].offset;
+  }
+
+  // gbm only borrows the fds, they stay with the params
+  gbm_bo *bo = gbm_bo_import(params->gbm, GBM_BO_IMPORT_FD_MODIFIER, &data, 0);
+  if (!bo)
+    return false;
+  gbm_bo_destroy(bo);
+  return true;
+}
+
+/**
+ * @brief Turn validated params into a `wl_buffer' with the given id, 0
+ * letting the server pick one.  The buffer takes over the fds.
+ */
+static shared_t<resource_t<shm_buffer_t>>
+create_buffer(wl_client   *client,
+              wl_resource *resource,
+              uint32_t     id,
+              int32_t      width,
+              int32_t      height,
+              uint32_t     format) {
+  auto *params = (linux_buffer_params_t *)wl_resource_get_user_data(resource);
+  auto  buffer = make_resource<shm_buffer_t>(client, wl_buffer_interface, wl_buffer_impl, 1, id);
+
+  buffer->offset = 0;
+  buffer->width  = width;
+  buffer->height = height;
+  buffer->stride = params->planes[0].stride;
+
+  // Keep `format' meaningful for code that only knows `wl_shm'
+  buffer->format = format == DRM_FORMAT_ARGB8888   ? WL_SHM_FORMAT_ARGB8888
+                   : format == DRM_FORMAT_XRGB8888 ? WL_SHM_FORMAT_XRGB8888
+                                                   : format;
+
+  buffer->dmabuf = dmabuf_attributes_t{ .planes     = params->planes,
+                                        .num_planes = (uint32_t)std::countr_one(params->added),
+                                        .format     = format,
+                                        .modifier   = params->modifier };
+  params->added  = 0;
+  return buffer;
+}
+
+void
+linux_buffer_params_create(wl_client   *client,
+                           wl_resource *resource,
+                           int32_t      width,
+                           int32_t      height,
+                           uint32_t     format,
+                           uint32_t     flags) {
+  if (!validate(resource, width, height, format))
+    return;
+
+  // We sample the buffer as it is, flipped or interlaced contents are
+  // not something we can show.
+  if (flags != 0) {
+    zwp_linux_buffer_params_v1_send_failed(resource);
+    return;
+  }
+
+  if (!importable((linux_buffer_params_t *)wl_resource_get_user_data(resource),
+                  width,
+                  height,
+                  format)) {
+    WARN("dmabuf: Failed to import a {}x{} buffer of format {:#x}", width, height, format);
+    zwp_linux_buffer_params_v1_send_failed(resource);
+    return;
+  }
+
+  auto buffer = create_buffer(client, resource, 0, width, height, format);
+  zwp_linux_buffer_params_v1_send_created(resource, buffer->resource());
+}
+
+void
+linux_buffer_params_create_immed(wl_client   *client,
+                                 wl_resource *resource,
+                                 uint32_t     buffer_id,
+                                 int32_t      width,
+                                 int32_t      height,
+                                 uint32_t     format,
+                                 uint32_t     flags) {
+  if (!validate(resource, width, height, format))
+    return;
+
+  // There is no failing a buffer the client already uses
+  if (flags != 0) {
+    wl_resource_post_error(resource,
+                           ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER,
+                           "Unsupported buffer flags %#x.",
+                           flags);
+    return;
+  }
+
+  if (!importable((linux_buffer_params_t *)wl_resource_get_user_data(resource),
+                  width,
+                  height,
+                  format)) {
+    wl_resource_post_error(resource,
+                           ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER,
+                           "Failed to import a %dx%d buffer of format %#x.",
+                           width,
+                           height,
+                           format);
+    return;
+  }
+
+  create_buffer(client, resource, buffer_id, width, height, format);
+}
 
 struct zwp_linux_buffer_params_v1_interface linux_buffer_params_impl = {
-  nullptr,
-  [](struct wl_client   *client,
-     struct wl_resource *resource,
-     int32_t             fd,
-     uint32_t            plane_idx,
-     uint32_t            offset,
-     uint32_t            stride,
-     uint32_t            modifier_hi,
-     uint32_t modifier_lo) { WARN("zwp_linux_buffer_params_v1::add - not implemented!"); },
-  nullptr,
-  nullptr
+  .destroy      = linux_buffer_params_destroy,
+  .add          = linux_buffer_params_add,
+  .create       = linux_buffer_params_create,
+  .create_immed = linux_buffer_params_create_immed,
 };
+
+void
+create_linux_buffer_params(wl_client *client, wl_resource *dmabuf_protocol, uint32_t id) {
+  wl_resource *resource = wl_resource_create(
+    client, &zwp_linux_buffer_params_v1_interface, wl_resource_get_version(dmabuf_protocol), id);
+  if (!resource) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  auto *dmabuf = (dmabuf_t *)wl_resource_get_user_data(dmabuf_protocol);
+  wl_resource_set_implementation(resource,
+                                 &linux_buffer_params_impl,
+                                 new linux_buffer_params_t(dmabuf->formats, dmabuf->drm.data->gbm),
+                                 [](wl_resource *res) {
+                                   delete (linux_buffer_params_t *)wl_resource_get_user_data(res);
+                                 });
+}
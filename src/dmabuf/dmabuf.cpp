@@ -6,41 +6,53 @@
 #include "barock/dmabuf/feedback.hpp"
 
 #include "../log.hpp"
+#include <drm_fourcc.h>
 #include <wayland-server-core.h>
 
-struct zwp_linux_dmabuf_v1_interface dmabuf_impl{
-  [](wl_client *, wl_resource *) { WARN("dmabuf#destroy - not impemented!"); },
-  [](wl_client *client, wl_resource *dmabuf_protocol, uint32_t id) {
-    INFO("dmabuf#create_params");
-
-    wl_resource                     *buffer_params = wl_resource_create(
-      client, &zwp_linux_buffer_params_v1_interface, wl_resource_get_version(dmabuf_protocol), id);
-    if (!buffer_params) {
-      wl_client_post_no_memory(client);
-    }
+void
+dmabuf_destroy(wl_client *, wl_resource *dmabuf) {
+  wl_resource_destroy(dmabuf);
+}
 
-    wl_resource_set_implementation(buffer_params, &linux_buffer_params_impl, nullptr, nullptr);
-  },
-  create_dmabuf_feedback_v1_resource,
-  nullptr
+struct zwp_linux_dmabuf_v1_interface dmabuf_impl{
+  .destroy              = dmabuf_destroy,
+  .create_params        = create_linux_buffer_params,
+  .get_default_feedback = create_dmabuf_feedback_v1_resource,
+  .get_surface_feedback = create_dmabuf_surface_feedback_v1_resource,
 };
 
 namespace barock {
-  dmabuf_t::dmabuf_t(compositor_t &comp)
-    : compositor(comp) {
-    wl_global_create(comp.display(), &zwp_linux_dmabuf_v1_interface, VERSION, nullptr, bind);
+  dmabuf_t::dmabuf_t(wl_display *display, service_registry_t &registry, minidrm::drm::handle_t &drm)
+    : display(display)
+    , registry(registry)
+    , drm(drm)
+    , formats(drm) {
+    dmabuf_global = wl_global_create(display, &zwp_linux_dmabuf_v1_interface, VERSION, this, bind);
   }
 
   void
-  dmabuf_t::bind(wl_client *client, void *, uint32_t version, uint32_t id) {
-    INFO("DMABUF BIND");
+  dmabuf_t::bind(wl_client *client, void *ud, uint32_t version, uint32_t id) {
     wl_resource *resource = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface, version, id);
     if (!resource) {
       wl_client_post_no_memory(client);
       return;
     }
 
-    wl_resource_set_implementation(resource, &dmabuf_impl, nullptr, nullptr);
-  }
+    wl_resource_set_implementation(resource, &dmabuf_impl, ud, nullptr);
+
+    // Clients before version 4 have no feedback objects, they learn
+    // about the formats right away.
+    if (version >= ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION)
+      return;
 
+    auto    *dmabuf = (dmabuf_t *)ud;
+    uint32_t last   = DRM_FORMAT_INVALID;
+    for (auto const &[format, modifier] : dmabuf->formats.pairs) {
+      if (version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION)
+        zwp_linux_dmabuf_v1_send_modifier(resource, format, modifier >> 32, modifier & 0xffffffff);
+      else if (format != last)
+        zwp_linux_dmabuf_v1_send_format(resource, format);
+      last = format;
+    }
+  }
 }
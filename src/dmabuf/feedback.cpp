@@ -1,130 +1,270 @@
 #include "barock/dmabuf/feedback.hpp"
+#include "barock/core/surface.hpp"
+#include "barock/dmabuf/dmabuf.hpp"
+#include "barock/resource.hpp"
+#include "barock/util.hpp"
 
 #include "../log.hpp"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <algorithm>
+#include <cstring>
 #include <drm_fourcc.h>
+#include <fcntl.h>
 #include <stdexcept>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
-#include <vector>
+#include <wayland-server-core.h>
 
-struct zwp_linux_dmabuf_feedback_v1_interface linux_dmabuf_feedback_impl = { [](wl_client *,
-                                                                                wl_resource *) {
-  WARN("dmabuf_feedback#destroy - not implemented");
-} };
+using namespace barock;
+
+/**
+ * @brief How long a surface counts as a scanout candidate, after an
+ * output last wanted to put it on a plane.  Keeps the feedback from
+ * flapping with every frame.
+ */
+static constexpr uint32_t SCANOUT_HOLD_MSEC = 1000;
+
+/**
+ * @brief Stored in the metadata of a surface, while it has feedback
+ * objects.
+ */
+struct surface_feedback_t {
+  std::vector<wl_resource *> resources;
+  bool                       scanout   = false; ///< Whether the last feedback had a scanout tranche
+  bool                       connected = false; ///< Whether we listen to commits already
+};
+
+/**
+ * @brief Whether an output recently tried to put `surface' onto a
+ * plane, as is.
+ */
+static bool
+wants_scanout(const surface_t &surface) {
+  uint32_t last = surface.offload_msec.load();
+  return last != 0 && current_time_msec() - last < SCANOUT_HOLD_MSEC;
+}
+
+/**
+ * @brief Query the format/modifier pairs EGL can import for sampling.
+ * Drivers without EGL_EXT_image_dma_buf_import_modifiers only get
+ * the formats every driver does, with the implicit modifier.
+ */
+static std::vector<dmabuf_formats_t::pair_t>
+query_egl_formats(EGLDisplay display) {
+  std::vector<dmabuf_formats_t::pair_t> pairs;
+
+  const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+  auto        query_formats =
+    (PFNEGLQUERYDMABUFFORMATSEXTPROC)eglGetProcAddress("eglQueryDmaBufFormatsEXT");
+  auto query_modifiers =
+    (PFNEGLQUERYDMABUFMODIFIERSEXTPROC)eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+  if (!extensions || !strstr(extensions, "EGL_EXT_image_dma_buf_import_modifiers") ||
+      !query_formats || !query_modifiers) {
+    WARN("EGL_EXT_image_dma_buf_import_modifiers is not supported, only advertising ARGB8888 "
+         "and XRGB8888 with implicit modifiers");
+    return { { DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_INVALID },
+             { DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_INVALID } };
+  }
+
+  EGLint num_formats = 0;
+  query_formats(display, 0, nullptr, &num_formats);
+  std::vector<EGLint> formats(num_formats);
+  query_formats(display, num_formats, formats.data(), &num_formats);
+
+  for (EGLint format : formats) {
+    EGLint num_modifiers = 0;
+    query_modifiers(display, format, 0, nullptr, nullptr, &num_modifiers);
+    std::vector<EGLuint64KHR> modifiers(num_modifiers);
+    std::vector<EGLBoolean>   external_only(num_modifiers);
+    query_modifiers(
+      display, format, num_modifiers, modifiers.data(), external_only.data(), &num_modifiers);
+
+    // We sample through GL_TEXTURE_2D, external only layouts are of no
+    // use to us.
+    bool sampled = false;
+    for (EGLint i = 0; i < num_modifiers; ++i) {
+      if (!external_only[i]) {
+        pairs.emplace_back(format, modifiers[i]);
+        sampled = true;
+      }
+    }
+
+    // Without explicit modifier the driver picks the layout it
+    // allocates by default.  Whether that is external only, EGL doesn't
+    // say; it is for YUV, unless one of the explicit layouts isn't.
+    if (sampled || (num_modifiers == 0 && !is_yuv(format)))
+      pairs.emplace_back(format, DRM_FORMAT_MOD_INVALID);
+  }
+
+  return pairs;
+}
+
+namespace barock {
+  dmabuf_formats_t::dmabuf_formats_t(minidrm::drm::handle_t &drm) {
+    drm.init_egl();
+    pairs = query_egl_formats(drm->egl.display);
+
+    // Tranches refer to the table with 16 bit indices
+    if (pairs.size() > UINT16_MAX + 1)
+      pairs.resize(UINT16_MAX + 1);
+
+    struct stat st;
+    device = fstat(drm.fd, &st) == 0 ? st.st_rdev : 0;
+
+    // Whatever any of the planes can scan out, and we can sample in
+    // case it ends up composited after all.
+    std::vector<pair_t> scannable;
+    for (auto const &plane : drm.planes()) {
+      if (plane.type == DRM_PLANE_TYPE_CURSOR)
+        continue;
+      auto formats = drm.plane_formats(plane.id);
+      scannable.insert(scannable.end(), formats.begin(), formats.end());
+    }
+
+    for (size_t i = 0; i < pairs.size(); ++i) {
+      all.push_back(i);
+      if (std::find(scannable.begin(), scannable.end(), pairs[i]) != scannable.end())
+        scanout.push_back(i);
+    }
+
+    struct entry_t {
+      uint32_t format;
+      uint32_t padding;
+      uint64_t modifier;
+    };
+    std::vector<entry_t> table;
+    for (auto const &[format, modifier] : pairs)
+      table.push_back({ .format = format, .padding = 0, .modifier = modifier });
+    size = table.size() * sizeof(entry_t);
+
+    // Clients map the table themselves, the seals make sure none of
+    // them can change it under the others.
+    fd = memfd_create("barock-dmabuf-formats", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+      ERROR("Failed to create memory file: {}", strerror(errno));
+      throw std::runtime_error("failed to create memory fd");
+    }
+
+    if (write(fd, table.data(), size) != (ssize_t)size ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+      ERROR("Failed to write the dmabuf format table: {}", strerror(errno));
+      close(fd);
+      throw std::runtime_error("failed to write the dmabuf format table");
+    }
+
+    INFO("dmabuf: {} format/modifier pairs, {} of them for scanout", pairs.size(), scanout.size());
+  }
+
+  dmabuf_formats_t::~dmabuf_formats_t() {
+    close(fd);
+  }
+
+  bool
+  dmabuf_formats_t::supported(uint32_t format, uint64_t modifier) const {
+    return std::find(pairs.begin(), pairs.end(), pair_t{ format, modifier }) != pairs.end();
+  }
+
+  void
+  dmabuf_formats_t::send(wl_resource *feedback, bool with_scanout) const {
+    wl_array dev;
+    wl_array_init(&dev);
+    *(dev_t *)wl_array_add(&dev, sizeof(dev_t)) = device;
+
+    auto tranche = [&](const std::vector<uint16_t> &indices, uint32_t flags) {
+      wl_array array;
+      wl_array_init(&array);
+      void *data = wl_array_add(&array, indices.size() * sizeof(uint16_t));
+      memcpy(data, indices.data(), indices.size() * sizeof(uint16_t));
+
+      zwp_linux_dmabuf_feedback_v1_send_tranche_target_device(feedback, &dev);
+      zwp_linux_dmabuf_feedback_v1_send_tranche_flags(feedback, flags);
+      zwp_linux_dmabuf_feedback_v1_send_tranche_formats(feedback, &array);
+      zwp_linux_dmabuf_feedback_v1_send_tranche_done(feedback);
+      wl_array_release(&array);
+    };
+
+    zwp_linux_dmabuf_feedback_v1_send_format_table(feedback, fd, size);
+    zwp_linux_dmabuf_feedback_v1_send_main_device(feedback, &dev);
+
+    // Tranches go in order of preference
+    if (with_scanout && !scanout.empty())
+      tranche(scanout, ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT);
+    tranche(all, 0);
+
+    zwp_linux_dmabuf_feedback_v1_send_done(feedback);
+    wl_array_release(&dev);
+  }
+}
+
+struct zwp_linux_dmabuf_feedback_v1_interface linux_dmabuf_feedback_impl = {
+  [](wl_client *, wl_resource *feedback) { wl_resource_destroy(feedback); }
+};
 
 void
 create_dmabuf_feedback_v1_resource(wl_client *client, wl_resource *dmabuf_protocol, uint32_t id) {
-  INFO("dmabuf_v1#get_default_feedback");
-
-  /*
-    This request creates a new wp_linux_dmabuf_feedback object not
-    bound to a particular surface. This object will deliver
-    feedback about dmabuf parameters to use if the client doesn't
-    support per-surface feedback (see get_surface_feedback).
-  */
+  auto *dmabuf = (dmabuf_t *)wl_resource_get_user_data(dmabuf_protocol);
 
   wl_resource *feedback = wl_resource_create(
     client, &zwp_linux_dmabuf_feedback_v1_interface, wl_resource_get_version(dmabuf_protocol), id);
   if (!feedback) {
     wl_client_post_no_memory(client);
+    return;
   }
 
   wl_resource_set_implementation(feedback, &linux_dmabuf_feedback_impl, nullptr, nullptr);
+  dmabuf->formats.send(feedback, false);
+}
 
-  /*
-    dmabuf feedback
-
-    This object advertises dmabuf parameters feedback. This includes
-    the preferred devices and the supported formats/modifiers.
-
-    The parameters are sent once when this object is created and
-    whenever they change. The done event is always sent once after all
-    parameters have been sent. When a single parameter changes, all
-    parameters are re-sent by the compositor.
-
-    Compositors can re-send the parameters when the current client
-    buffer allocations are sub-optimal. Compositors should not re-send
-    the parameters if re-allocating the buffers would not result in a
-    more optimal configuration. In particular, compositors should
-    avoid sending the exact same parameters multiple times in a row.
-
-    The tranche_target_device and tranche_formats events are grouped
-    by tranches of preference. For each tranche, a
-    tranche_target_device, one tranche_flags and one or more
-    tranche_formats events are sent, followed by a tranche_done event
-    finishing the list. The tranches are sent in descending order of
-    preference. All formats and modifiers in the same tranche have the
-    same preference.
-
-    To send parameters, the compositor sends one main_device event,
-    tranches (each consisting of one tranche_target_device event, one
-    tranche_flags event, tranche_formats events and then a
-    tranche_done event), then one done event.
-  */
-
-  std::vector<std::pair<uint32_t, uint64_t>> fmtmods = {
-    { DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR },
-    { DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR },
-    // … etc.
-  };
-  size_t n          = fmtmods.size();
-  size_t table_size = n * 16;
-
-  int fd = memfd_create("", 0);
-  if (fd < 0) {
-    ERROR("Failed to create memory file: {}", strerror(errno));
-    throw std::runtime_error("failed to create memory fd");
+void
+create_dmabuf_surface_feedback_v1_resource(wl_client   *client,
+                                           wl_resource *dmabuf_protocol,
+                                           uint32_t     id,
+                                           wl_resource *wl_surface) {
+  auto *dmabuf  = (dmabuf_t *)wl_resource_get_user_data(dmabuf_protocol);
+  auto  surface = from_wl_resource<surface_t>(wl_surface);
+
+  wl_resource *feedback = wl_resource_create(
+    client, &zwp_linux_dmabuf_feedback_v1_interface, wl_resource_get_version(dmabuf_protocol), id);
+  if (!feedback) {
+    wl_client_post_no_memory(client);
+    return;
   }
 
-  ftruncate(fd, table_size);
+  auto weak = new weak_t<resource_t<surface_t>>(surface);
+  wl_resource_set_implementation(
+    feedback, &linux_dmabuf_feedback_impl, weak, [](wl_resource *res) {
+      auto weak_surface = (weak_t<resource_t<surface_t>> *)wl_resource_get_user_data(res);
+      if (auto surface = weak_surface->lock(); surface) {
+        auto &resources = surface->metadata.get<surface_feedback_t>().resources;
+        std::erase(resources, res);
+      }
+      delete weak_surface;
+    });
 
-  void *map = mmap(nullptr, table_size, PROT_WRITE, MAP_SHARED, fd, 0);
-  for (size_t i = 0; i < n; i++) {
-    uint32_t fmt = fmtmods[i].first;
-    uint64_t mod = fmtmods[i].second;
-    struct {
-      uint32_t format;
-      uint32_t padding;
-      uint64_t modifier;
-    } *ent        = ((decltype(ent))map) + i;
-    ent->format   = fmt;
-    ent->padding  = 0;
-    ent->modifier = mod;
-  }
-  msync(map, table_size, MS_SYNC);
-  munmap(map, table_size);
-
-  wl_array device_arr;
-  wl_array_init(&device_arr);
-  dev_t dev = 0;                                      // your DRM device id
-  void *p   = wl_array_add(&device_arr, sizeof(dev)); // careful with size
-  memcpy(p, &dev, sizeof(dev));
-  zwp_linux_dmabuf_feedback_v1_send_main_device(feedback, &device_arr);
-  wl_array_release(&device_arr);
-
-  zwp_linux_dmabuf_feedback_v1_send_format_table(feedback, fd, table_size);
-  close(fd);
-
-  wl_array target_dev_arr;
-  wl_array_init(&target_dev_arr);
-  p = wl_array_add(&target_dev_arr, sizeof(dev));
-  memcpy(p, &dev, sizeof(dev));
-  zwp_linux_dmabuf_feedback_v1_send_tranche_target_device(feedback, &target_dev_arr);
-  wl_array_release(&target_dev_arr);
-
-  // flags
-  uint32_t flags = 0; // or ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT
-  zwp_linux_dmabuf_feedback_v1_send_tranche_flags(feedback, flags);
-
-  wl_array indices;
-  wl_array_init(&indices);
-  for (uint16_t i = 0; i < n; i++) {
-    uint16_t *p = (uint16_t *)wl_array_add(&indices, sizeof(i));
-    *p          = i;
-  }
-  zwp_linux_dmabuf_feedback_v1_send_tranche_formats(feedback, &indices);
-  wl_array_release(&indices);
+  auto &state = surface->metadata.ensure<surface_feedback_t>();
+  if (state.resources.empty())
+    state.scanout = wants_scanout(*surface);
+  state.resources.push_back(feedback);
+  dmabuf->formats.send(feedback, state.scanout);
+
+  if (state.connected)
+    return;
+  state.connected = true;
+
+  // Whether the surface can go onto a plane is decided by the outputs
+  // every frame, the client learns about it with its next commit.
+  surface->events.on_buffer_attach.connect(
+    [surface = surface.get(), &formats = dmabuf->formats](shm_buffer_t &) {
+      auto &state   = surface->metadata.get<surface_feedback_t>();
+      bool  scanout = wants_scanout(*surface);
+      if (scanout == state.scanout)
+        return signal_action_t::eOk;
 
-  zwp_linux_dmabuf_feedback_v1_send_tranche_done(feedback);
-  zwp_linux_dmabuf_feedback_v1_send_done(feedback);
+      state.scanout = scanout;
+      for (auto resource : state.resources)
+        formats.send(resource, scanout);
+      return signal_action_t::eOk;
+    });
 }
@@ -0,0 +1,82 @@
+#include "barock/dmabuf/params.hpp"
+#include "wl/linux-dmabuf-v1-protocol.h"
+
+#include <bit>
+#include <format>
+#include <unistd.h>
+
+using namespace barock;
+
+std::optional<params_error_t>
+dmabuf_params_t::add(int32_t  fd,
+                     uint32_t plane_idx,
+                     uint32_t offset,
+                     uint32_t stride,
+                     uint64_t modifier,
+                     bool     same_modifier) {
+  if (used)
+    return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                           "Params were already used to create a wl_buffer." };
+
+  if (plane_idx >= dmabuf_attributes_t::MAX_PLANES)
+    return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+                           std::format("Plane index {} is out of bounds.", plane_idx) };
+
+  if (added & (1 << plane_idx))
+    return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+                           std::format("Plane {} was already set.", plane_idx) };
+
+  // One buffer, one layout
+  if (added && modifier != this->modifier && same_modifier)
+    return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+                           "All planes must use the same modifier." };
+
+  planes[plane_idx]  = { .fd = fd, .offset = offset, .stride = stride };
+  added             |= 1 << plane_idx;
+  this->modifier     = modifier;
+  return std::nullopt;
+}
+
+std::optional<params_error_t>
+dmabuf_params_t::check(int32_t width, int32_t height, uint32_t format, bool advertised) {
+  if (used)
+    return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                           "Params were already used to create a wl_buffer." };
+  used = true;
+
+  // Planes have to be consecutive, starting at zero.
+  uint32_t num_planes = std::countr_one(added);
+  if (num_planes == 0 || added != (1u << num_planes) - 1)
+    return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+                           "Missing planes to create a buffer." };
+
+  if (!advertised)
+    return params_error_t{
+      ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+      std::format("Format {:#x} with modifier {:#x} was not advertised.", format, modifier)
+    };
+
+  if (width <= 0 || height <= 0)
+    return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS,
+                           std::format("Invalid dimensions {}x{}.", width, height) };
+
+  for (uint32_t i = 0; i < num_planes; ++i) {
+    auto const &plane = planes[i];
+    if ((uint64_t)plane.offset + (uint64_t)plane.stride * height > UINT32_MAX)
+      return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+                             std::format("Size of plane {} overflows.", i) };
+
+    // Not every dmabuf exporter knows its size, only check those that
+    // do.  The first plane has to fit entirely, the others may be
+    // subsampled.
+    off_t size = lseek(plane.fd, 0, SEEK_END);
+    if (size == -1)
+      continue;
+    if ((uint64_t)plane.offset + plane.stride > (uint64_t)size ||
+        (i == 0 && plane.offset + (uint64_t)plane.stride * height > (uint64_t)size))
+      return params_error_t{ ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+                             std::format("Plane {} is out of the dmabuf bounds.", i) };
+  }
+
+  return std::nullopt;
+}
@@ -1,4 +1,5 @@
 #include "barock/fbo.hpp"
+#include "barock/render/opengl.hpp"
 #include <GLES2/gl2.h>
 
 using namespace barock;
@@ -12,9 +13,9 @@ fbo_t::fbo_t()
 
 fbo_t::~fbo_t() {
   if (texture != 0)
-    glDeleteTextures(1, &texture);
+    gl_state_t::current().delete_textures(1, &texture);
   if (handle != 0)
-    glDeleteFramebuffers(1, &handle);
+    gl_state_t::current().delete_framebuffers(1, &handle);
 }
 
 fbo_t::fbo_t(int32_t width, int32_t height, GLenum format)
@@ -24,14 +25,15 @@ fbo_t::fbo_t(int32_t width, int32_t height, GLenum format)
   glGenFramebuffers(1, &handle);
 
   glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
+  auto &gl = gl_state_t::current();
+  gl.bind_texture(0, texture);
 
   glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-  glBindFramebuffer(GL_FRAMEBUFFER, handle);
+  gl.bind_framebuffer(handle);
 
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
 
@@ -40,8 +42,8 @@ fbo_t::fbo_t(int32_t width, int32_t height, GLenum format)
   }
 
   // Unbind texture & framebuffer
-  glBindTexture(GL_TEXTURE_2D, 0);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gl.bind_texture(0, 0);
+  gl.bind_framebuffer(0);
 }
 
 fbo_t::fbo_t(barock::fbo_t &&other)
@@ -59,7 +61,7 @@ fbo_t::bind() {
   if (!valid())
     throw invalid_fbo_t{};
 
-  glBindFramebuffer(GL_FRAMEBUFFER, handle);
+  gl_state_t::current().bind_framebuffer(handle);
 }
 
 bool
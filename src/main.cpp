@@ -84,7 +84,6 @@ main() {
   for (auto &output : compositor.registry_.output->outputs()) {
     INFO("Starting rendering thread for output {}", output->connector().name());
     std::thread([&] {
-      std::condition_variable_any           &cv = output->dirty_cv();
       std::unique_lock<std::recursive_mutex> lock(output->dirty());
 
       // Perform the mode set on this thread, EGL is a thread local
@@ -93,11 +92,24 @@ main() {
       compositor.registry_.output->mode_set(*output);
 
       for (;;) {
-        cv.wait(lock);
+        // With VRR, idle outputs also wake up to ramp the refresh
+        // rate down.
+        output->wait(lock);
+        // Don't paint right away, wait until just before the next
+        // vblank, so commits arriving until then make it as well.
+        output->schedule(lock);
+
         // Whenever we wake up, we re-render.  The subscribers of
         // `output_t::on_repaint` are responsible for adhering to the
-        // damage tree, we just submit.
+        // output damage, we just submit.  Surfaces on overlay planes
+        // don't cause damage, their updates only flip the planes.
+        //
+        // Painting waits for page flips, which are dispatched on the
+        // wayland thread.  That one takes `dirty' to add damage, so we
+        // must not hold it meanwhile.
+        lock.unlock();
         output->paint();
+        lock.lock();
       }
     }).detach();
   }
@@ -0,0 +1,153 @@
+#include "barock/render/gl_state.hpp"
+
+#include <EGL/egl.h>
+#include <algorithm>
+
+using namespace barock;
+
+std::atomic<uint64_t> gl_state_t::deleted_{ 0 };
+std::atomic<uint64_t> gl_state_t::saved_{ 0 };
+
+gl_state_t &
+gl_state_t::current() {
+  static thread_local EGLContext context = EGL_NO_CONTEXT;
+  static thread_local gl_state_t state;
+
+  // A new context, an output set up again on this thread, knows nothing of
+  // what we bound in the old one.
+  if (EGLContext now = eglGetCurrentContext(); now != context) {
+    context = now;
+    state   = gl_state_t{};
+  }
+  return state;
+}
+
+template<typename _Ty>
+bool
+gl_state_t::update(_Ty &cached, const _Ty &value) {
+  if (cached == value) {
+    saved_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  cached = value;
+  return true;
+}
+
+void
+gl_state_t::use_program(GLuint program) {
+  if (update(program_, program))
+    glUseProgram(program);
+}
+
+void
+gl_state_t::bind_framebuffer(GLuint framebuffer) {
+  if (update(framebuffer_, framebuffer))
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void
+gl_state_t::delete_framebuffers(GLsizei count, const GLuint *framebuffers) {
+  glDeleteFramebuffers(count, framebuffers);
+  if (std::find(framebuffers, framebuffers + count, framebuffer_) != framebuffers + count)
+    framebuffer_ = 0;
+}
+
+void
+gl_state_t::bind_texture(GLuint unit, GLuint texture) {
+  // Another thread deleted textures, what we remember as bound may
+  // be a name that was handed out again since.
+  if (uint64_t deleted = deleted_.load(std::memory_order_acquire); deleted != seen_) {
+    textures_.fill(0);
+    seen_ = deleted;
+  }
+
+  if (update(unit_, unit))
+    glActiveTexture(GL_TEXTURE0 + unit);
+  if (unit >= UNITS) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    return;
+  }
+  if (update(textures_[unit], texture))
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void
+gl_state_t::delete_textures(GLsizei count, const GLuint *textures) {
+  glDeleteTextures(count, textures);
+
+  // A name may be handed out again, the next bind must not be skipped
+  for (auto &bound : textures_)
+    if (std::find(textures, textures + count, bound) != textures + count)
+      bound = 0;
+  if (deleted_.fetch_add(1, std::memory_order_release) == seen_)
+    ++seen_;
+}
+
+void
+gl_state_t::bind_buffer(GLenum target, GLuint buffer) {
+  auto &bound = target == GL_ARRAY_BUFFER ? array_buffer_ : element_buffer_;
+  if (update(bound, buffer))
+    glBindBuffer(target, buffer);
+}
+
+void
+gl_state_t::delete_buffers(GLsizei count, const GLuint *buffers) {
+  glDeleteBuffers(count, buffers);
+  for (auto bound : { &array_buffer_, &element_buffer_ })
+    if (std::find(buffers, buffers + count, *bound) != buffers + count)
+      *bound = 0;
+}
+
+void
+gl_state_t::attributes(uint32_t mask) {
+  uint32_t changed = attributes_ ^ mask;
+  if (changed == 0) {
+    saved_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  for (GLuint i = 0; i < 32; ++i) {
+    if (!(changed & (1u << i)))
+      continue;
+    if (mask & (1u << i))
+      glEnableVertexAttribArray(i);
+    else
+      glDisableVertexAttribArray(i);
+  }
+  attributes_ = mask;
+}
+
+void
+gl_state_t::blend(bool enable) {
+  if (update(blend_, enable))
+    enable ? glEnable(GL_BLEND) : glDisable(GL_BLEND);
+}
+
+void
+gl_state_t::blend_func(GLenum src, GLenum dst) {
+  if (update(blend_func_, { src, dst }))
+    glBlendFunc(src, dst);
+}
+
+void
+gl_state_t::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  if (update(viewport_, { x, y, width, height }))
+    glViewport(x, y, width, height);
+}
+
+void
+gl_state_t::scissor(bool enable) {
+  if (update(scissor_, enable))
+    enable ? glEnable(GL_SCISSOR_TEST) : glDisable(GL_SCISSOR_TEST);
+}
+
+void
+gl_state_t::scissor_box(GLint x, GLint y, GLsizei width, GLsizei height) {
+  if (update(scissor_box_, { x, y, width, height }))
+    glScissor(x, y, width, height);
+}
+
+uint64_t
+gl_state_t::saved() {
+  return saved_.load(std::memory_order_relaxed);
+}
@@ -4,26 +4,43 @@
 #include "barock/core/shm_pool.hpp"
 #include "barock/singleton.hpp"
 #include "barock/util.hpp"
+#include "wl/presentation-time-protocol.h"
 #include "wl/wayland-protocol.h"
 
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <drm_fourcc.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
 #include <stdexcept>
+#include <utility>
 
 extern "C" {
 #include <X11/Xcursor/Xcursor.h>
 }
 
+// glGetError waits for the GPU, errors normally arrive through the
+// KHR_debug callback instead.  BAROCK_GL_STRICT checks every call.
+#if defined(BAROCK_GL_STRICT) && !defined(NDEBUG)
 #define GL_CHECK                                                                                   \
   do {                                                                                             \
     GLenum err = glGetError();                                                                     \
     if (err != GL_NO_ERROR) {                                                                      \
       ERROR("OpenGL Error ({}:{}): {}", __FILE__, __LINE__, err);                                  \
-      printf("\n");                                                                                \
-      fflush(stdout);                                                                              \
       throw std::runtime_error{ "OpenGL Error" };                                                  \
     }                                                                                              \
   } while (0)
+#else
+#define GL_CHECK                                                                                   \
+  do {                                                                                             \
+  } while (0)
+#endif
 
 using namespace barock;
 
@@ -45,14 +62,140 @@ compile_shader(GLenum type, const char *source) {
   return shader;
 }
 
-static gl_shader_t
-create_program(const char *vs_src, const char *fs_src) {
-  GLuint vs = compile_shader(GL_VERTEX_SHADER, vs_src);
-  GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fs_src);
+/**
+ * @brief Where the binary of program `name' is cached.  The file name
+ * covers the sources, the attribute bindings and the driver, so any of
+ * them changing means a rebuild.  Empty, if there is no cache directory.
+ */
+static std::filesystem::path
+program_cache_path(const char                  *name,
+                   const char                  *vertex,
+                   const char                  *fragment,
+                   std::span<const char *const> attributes) {
+  std::filesystem::path directory;
+  if (auto cache = getenv("XDG_CACHE_HOME"); cache && *cache)
+    directory = cache;
+  else if (auto home = getenv("HOME"); home && *home)
+    directory = std::filesystem::path{ home } / ".cache";
+  else
+    return {};
+
+  // Each part is terminated, so no two sets of them give the same key.
+  std::string key;
+  for (auto part : { vertex, fragment })
+    key.append(part).push_back('\0');
+  for (auto attribute : attributes)
+    key.append(attribute).push_back('\0');
+  for (GLenum string : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+    if (auto value = (const char *)glGetString(string); value)
+      key.append(value).push_back('\0');
+  }
+  return directory / "barock" / std::format("{}-{:016x}.bin", name, std::hash<std::string>{}(key));
+}
+
+/**
+ * @brief Whether the driver can hand out program binaries and take them
+ * back (GL_OES_get_program_binary).
+ */
+static bool
+program_binary_supported() {
+  static bool supported = [] {
+    auto extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "GL_OES_get_program_binary"))
+      return false;
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+    return formats > 0;
+  }();
+  return supported;
+}
+
+static bool
+load_program_binary(GLuint program, const std::filesystem::path &path) {
+  static auto program_binary = (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+
+  std::ifstream file{ path, std::ios::binary };
+  GLenum        format;
+  if (!program_binary || !file.read((char *)&format, sizeof(format)))
+    return false;
+
+  std::vector<char> binary{ std::istreambuf_iterator<char>{ file }, {} };
+  program_binary(program, format, binary.data(), binary.size());
+
+  // Drivers reject binaries of another version, that is no error.
+  GLint ok;
+  glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  glGetError();
+  return ok;
+}
+
+static void
+save_program_binary(GLuint program, const std::filesystem::path &path) {
+  static auto get_program_binary =
+    (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress("glGetProgramBinaryOES");
+
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+  if (!get_program_binary || length <= 0)
+    return;
+
+  GLenum            format;
+  std::vector<char> binary(length);
+  get_program_binary(program, length, nullptr, &format, binary.data());
+
+  // Written aside and moved in place, so a crash never leaves half a
+  // binary behind.
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+
+  auto temporary = path;
+  temporary += ".tmp";
+  {
+    std::ofstream file{ temporary, std::ios::binary | std::ios::trunc };
+    file.write((const char *)&format, sizeof(format));
+    file.write(binary.data(), binary.size());
+    file.close();
+    if (!file) {
+      std::filesystem::remove(temporary, ec);
+      return;
+    }
+  }
+  std::filesystem::rename(temporary, path, ec);
+  if (ec) {
+    WARN("Failed to cache program binary {}: {}", path.string(), ec.message());
+    std::filesystem::remove(temporary, ec);
+  }
+}
+
+GLuint
+barock::gl_link_program(const char                  *name,
+                        const char                  *vertex,
+                        const char                  *fragment,
+                        std::span<const char *const> attributes) {
+  std::filesystem::path cache;
+  if (program_binary_supported())
+    cache = program_cache_path(name, vertex, fragment, attributes);
+
+  // Compiling is what makes startup slow, skip it whenever the driver
+  // still takes the binary of the last run.
+  if (!cache.empty()) {
+    GLuint program = glCreateProgram();
+    if (load_program_binary(program, cache)) {
+      TRACE("Loaded program '{}' from {}", name, cache.string());
+      return program;
+    }
+    glDeleteProgram(program);
+  }
+
+  GLuint vs = compile_shader(GL_VERTEX_SHADER, vertex);
+  GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fragment);
 
   GLuint program = glCreateProgram();
   glAttachShader(program, vs);
   glAttachShader(program, fs);
+  for (GLuint i = 0; i < attributes.size(); ++i)
+    glBindAttribLocation(program, i, attributes[i]);
   glLinkProgram(program);
 
   GLint ok;
@@ -66,27 +209,22 @@ create_program(const char *vs_src, const char *fs_src) {
 
   glDeleteShader(vs);
   glDeleteShader(fs);
-  return gl_shader_t{ program };
-}
-
-static void
-initialize_egl() {
-  static bool init = false;
-  if (init == true)
-    return;
 
-  auto &storage = singleton_t<gl_shader_storage_t>::ensure();
+  if (!cache.empty())
+    save_program_binary(program, cache);
+  return program;
+}
 
-  static const char *vs = R"(
+const char *const gl_quad_layout_t::VERTEX = R"(
         precision mediump float;
 
         attribute vec2 a_position;
         attribute vec2 a_texcoord;
+        attribute float a_texture;
         varying vec2 uv;
+        varying float unit;
 
         uniform vec2 u_screen_size;
-        uniform vec2 u_surface_size;
-        uniform vec2 u_surface_position;
 
         vec2 to_ndc(vec2 screenspace) {
           return (screenspace / u_screen_size * 2.0 - 1.0)
@@ -96,153 +234,607 @@ initialize_egl() {
 
         void main() {
           uv = a_texcoord;
-          gl_Position = vec4(to_ndc(u_surface_position + a_position * u_surface_size), 0.0, 1.0);
+          unit = a_texture;
+          gl_Position = vec4(to_ndc(a_position), 0.0, 1.0);
         }
     )";
 
-  static const char *fs = R"(
+// GLSL ES 1.0 only indexes samplers with constants
+const char *const gl_quad_layout_t::FRAGMENT = R"(
 precision mediump float;
 
 varying vec2 uv;
-uniform sampler2D u_texture;
+varying float unit;
+uniform sampler2D u_textures[8];
 
 void main() {
-    vec4 color = texture2D(u_texture, uv);
+    vec4 color;
+    if (unit < 0.5)
+        color = texture2D(u_textures[0], uv);
+    else if (unit < 1.5)
+        color = texture2D(u_textures[1], uv);
+    else if (unit < 2.5)
+        color = texture2D(u_textures[2], uv);
+    else if (unit < 3.5)
+        color = texture2D(u_textures[3], uv);
+    else if (unit < 4.5)
+        color = texture2D(u_textures[4], uv);
+    else if (unit < 5.5)
+        color = texture2D(u_textures[5], uv);
+    else if (unit < 6.5)
+        color = texture2D(u_textures[6], uv);
+    else
+        color = texture2D(u_textures[7], uv);
     gl_FragColor = color;
 }
 )";
 
-  storage.add("quad shader", create_program(vs, fs));
+static void GL_APIENTRY
+gl_debug_message(GLenum,
+                 GLenum        type,
+                 GLuint        id,
+                 GLenum        severity,
+                 GLsizei       length,
+                 const GLchar *message,
+                 const void *) {
+  std::string_view text{ message, length < 0 ? strlen(message) : (size_t)length };
+  if (type == GL_DEBUG_TYPE_ERROR_KHR || severity == GL_DEBUG_SEVERITY_HIGH_KHR)
+    ERROR("OpenGL ({:#x}): {}", id, text);
+  else if (severity == GL_DEBUG_SEVERITY_MEDIUM_KHR)
+    WARN("OpenGL ({:#x}): {}", id, text);
+  else if (severity == GL_DEBUG_SEVERITY_LOW_KHR)
+    INFO("OpenGL ({:#x}): {}", id, text);
+  else
+    TRACE("OpenGL ({:#x}): {}", id, text);
+}
+
+/**
+ * @brief Have the driver report errors through the logger
+ * (GL_KHR_debug), once for the shared context.
+ */
+static void
+initialize_debug_output() {
+  auto extensions = (const char *)glGetString(GL_EXTENSIONS);
+  if (!extensions || !strstr(extensions, "GL_KHR_debug")) {
+    WARN("GL_KHR_debug is not supported, OpenGL errors go unreported");
+    return;
+  }
+
+  auto message_callback =
+    (PFNGLDEBUGMESSAGECALLBACKKHRPROC)eglGetProcAddress("glDebugMessageCallbackKHR");
+  message_callback(gl_debug_message, nullptr);
+  glEnable(GL_DEBUG_OUTPUT_KHR);
+
+#if defined(BAROCK_GL_STRICT) && !defined(NDEBUG)
+  // Report on the offending call, not whenever the driver gets to it
+  glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+#else
+  auto message_control =
+    (PFNGLDEBUGMESSAGECONTROLKHRPROC)eglGetProcAddress("glDebugMessageControlKHR");
+  message_control(
+    GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION_KHR, 0, nullptr, GL_FALSE);
+#endif
+}
+
+static void
+initialize_egl() {
+  static bool init = false;
+  if (init == true)
+    return;
+
+  initialize_debug_output();
+
+  auto &program = singleton_t<gl_quad_program_t>::ensure();
+  auto &gl      = gl_state_t::current();
+  singleton_t<gl_texture_cache_t>::ensure();
+
+  // Every texture unit of the batch is sampled by its own sampler
+  static constexpr GLint units[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+  gl.use_program(program);
+  glUniform1iv(program.uniform<gl_quad_layout_t::uTextures>(), std::size(units), units);
 
   init = true;
 }
 
-const gl_shader_t &
-gl_shader_storage_t::by_name(const std::string &name) const {
-  if (!shaders_.contains(name))
-    throw std::runtime_error{ "No such shader" };
-  return shaders_.at(name);
+gl_renderer_t::gl_renderer_t(const minidrm::drm::mode_t &mode, minidrm::framebuffer::egl_t &&egl)
+  : mode_(mode)
+  , handle_(std::move(egl))
+  , tearing_(false) {
+  initialize_egl();
+}
+
+gl_renderer_t::gl_renderer_t(gl_renderer_t &&other)
+  : mode_(other.mode_)
+  , handle_(std::move(other.handle_))
+  , tearing_(other.tearing_)
+  , vbo_(std::exchange(other.vbo_, 0))
+  , ibo_(std::exchange(other.ibo_, 0)) {}
+
+gl_renderer_t::~gl_renderer_t() {
+  collect();
+  auto &gl = gl_state_t::current();
+  if (vbo_)
+    gl.delete_buffers(1, &vbo_);
+  if (ibo_)
+    gl.delete_buffers(1, &ibo_);
+  for (auto &[_, import] : imports_)
+    handle_.release(import);
 }
 
 void
-gl_shader_storage_t::add(const std::string &name, const gl_shader_t &shader) {
-  shaders_.emplace(name, shader);
+gl_renderer_t::bind() {
+  frontbuffer_ = handle_.acquire();
+  singleton_t<gl_texture_cache_t>::get().collect();
+  collect();
+
+  // Client buffers are premultiplied, blending is turned on per quad
+  auto &gl = gl_state_t::current();
+  gl.blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  GL_CHECK;
+
+  gl.viewport(0, 0, mode_.width(), mode_.height());
+  GL_CHECK;
 }
 
-gl_shader_t::gl_shader_t(GLuint shader)
-  : handle_(shader) {}
+int
+gl_renderer_t::buffer_age() const {
+  return frontbuffer_.age;
+}
 
 void
-gl_shader_t::bind() {
-  glUseProgram(handle_);
+gl_renderer_t::commit(present_handler_t on_presented) {
+  flush();
+
+  // Dmabufs sampled for this frame stay busy until it left the screen
+  buffers_t buffers = std::exchange(sampled_, {});
+  buffers.insert(buffers.end(), overlay_buffers_.begin(), overlay_buffers_.end());
+  handle_.present(
+    frontbuffer_, on_flip(std::move(buffers), std::move(on_presented)), overlays_, tearing_);
 }
 
-void
-gl_shader_t::uniform(const std::string &name, float v) const {
-  glUniform1f(glGetUniformLocation(handle_, name.c_str()), v);
-  GL_CHECK;
+gl_renderer_t::import_t
+gl_renderer_t::import(shared_t<resource_t<shm_buffer_t>> buffer) {
+  std::lock_guard<std::mutex> guard(scanout_mutex_);
+  if (auto it = imports_.find(buffer.get()); it != imports_.end())
+    return it->second;
+
+  auto    &dmabuf = *buffer->dmabuf;
+  int      fds[dmabuf_attributes_t::MAX_PLANES];
+  uint32_t offsets[dmabuf_attributes_t::MAX_PLANES], strides[dmabuf_attributes_t::MAX_PLANES];
+  for (uint32_t i = 0; i < dmabuf.num_planes; ++i) {
+    fds[i]     = dmabuf.planes[i].fd;
+    offsets[i] = dmabuf.planes[i].offset;
+    strides[i] = dmabuf.planes[i].stride;
+  }
+
+  auto fb = handle_.import(buffer->width,
+                           buffer->height,
+                           dmabuf.format,
+                           dmabuf.num_planes,
+                           fds,
+                           offsets,
+                           strides,
+                           dmabuf.modifier);
+  imports_.emplace(buffer.get(), fb);
+
+  // Clients keep reusing the same few buffers, so the import lives as
+  // long as the buffer does.  Unscannable buffers are remembered by an
+  // empty import.
+  buffer->on_destruct.connect([this](resource_t<shm_buffer_t> &buffer) {
+    std::lock_guard<std::mutex> guard(scanout_mutex_);
+    if (auto it = imports_.find(&buffer); it != imports_.end()) {
+      graveyard_.push_back(it->second);
+      imports_.erase(it);
+    }
+    return signal_action_t::eDelete;
+  });
+  return fb;
 }
 
-void
-gl_shader_t::uniform(const std::string &name, float v0, float v1) const {
-  glUniform2f(glGetUniformLocation(handle_, name.c_str()), v0, v1);
-  GL_CHECK;
+bool
+gl_renderer_t::scanout(surface_t &surface, present_handler_t on_presented) {
+  auto buffer = surface.state.buffer;
+  if (!buffer || !buffer->dmabuf)
+    return false;
+  if (buffer->width != (int32_t)mode_.width() || buffer->height != (int32_t)mode_.height())
+    return false;
+
+  collect();
+
+  auto fb = import(buffer);
+  if (fb.fb == 0)
+    return false;
+
+  if (!handle_.present_direct(
+        fb, on_flip({ buffer_ref_t{ buffer } }, std::move(on_presented)), tearing_))
+    return false;
+
+  // The flip took the overlay planes down.
+  overlays_.clear();
+  overlay_buffers_.clear();
+
+  // The client gets its buffer back once the next flip replaced it
+  // and nothing else holds it, see `flipped'.  The frame callback however is due now.
+  if (surface.frame_pending())
+    surface.frame_drawn(WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY);
+  return true;
 }
 
-void
-gl_shader_t::uniform(const std::string &name, float v0, float v1, float v2) const {
-  glUniform3f(glGetUniformLocation(handle_, name.c_str()), v0, v1, v2);
-  GL_CHECK;
+size_t
+gl_renderer_t::planes() const {
+  return handle_.overlay_planes.size();
 }
 
-void
-gl_shader_t::uniform(const std::string &name, float v0, float v1, float v2, float v3) const {
-  glUniform4f(glGetUniformLocation(handle_, name.c_str()), v0, v1, v2, v3);
-  GL_CHECK;
+bool
+gl_renderer_t::overlay(const std::vector<plane_assignment_t> &assignments) {
+  std::vector<minidrm::framebuffer::egl_t::overlay_t> overlays;
+  buffers_t                                           buffers;
+
+  for (auto const &assignment : assignments) {
+    auto buffer = assignment.surface->state.buffer;
+    if (!buffer || !buffer->dmabuf)
+      return false;
+
+    auto fb = import(buffer);
+    if (fb.fb == 0)
+      return false;
+
+    overlays.push_back({ .buffer = fb,
+                         .x      = assignment.bounds.x,
+                         .y      = assignment.bounds.y,
+                         .width  = (uint32_t)buffer->width,
+                         .height = (uint32_t)buffer->height });
+    buffers.emplace_back(buffer);
+  }
+
+  if (!handle_.test_overlays(overlays))
+    return false;
+
+  overlays_        = std::move(overlays);
+  overlay_buffers_ = std::move(buffers);
+  return true;
 }
 
-gl_shader_t::
-operator GLuint() const {
-  return handle_;
+bool
+gl_renderer_t::commit_planes(present_handler_t on_presented) {
+  collect();
+  return handle_.present_overlays(overlays_, on_flip(overlay_buffers_, std::move(on_presented)));
 }
 
-gl_renderer_t::gl_renderer_t(const minidrm::drm::mode_t &mode, minidrm::framebuffer::egl_t &&egl)
-  : mode_(mode)
-  , handle_(std::move(egl)) {
-  initialize_egl();
+minidrm::framebuffer::egl_t::flip_handler_t
+gl_renderer_t::on_flip(buffers_t buffers, present_handler_t on_presented) {
+  // Flip events carry the vblank timestamp and counter straight from
+  // the kernel, in CLOCK_MONOTONIC.  With VRR there is no fixed
+  // refresh to predict the next one from.
+  float    rate    = mode_.refresh_rate();
+  uint32_t refresh = rate > 0.f && !handle_.vrr ? 1000000000.f / rate : 0;
+  return [this, buffers = std::move(buffers), on_presented = std::move(on_presented), refresh](
+           uint32_t sec, uint32_t usec, uint32_t sequence, bool async, bool dropped) {
+    // A dropped frame left the screen as it was, its buffers are
+    // released along with this handler.
+    if (dropped) {
+      on_presented({ .usec = sec * 1000000ull + usec, .sequence = sequence, .discarded = true });
+      return;
+    }
+    flipped(buffers);
+
+    uint32_t flags =
+      WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK | WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+    if (!async)
+      flags |= WP_PRESENTATION_FEEDBACK_KIND_VSYNC;
+    on_presented({ .usec     = sec * 1000000ull + usec,
+                   .sequence = sequence,
+                   .refresh  = refresh,
+                   .flags    = flags });
+  };
 }
 
-gl_renderer_t::gl_renderer_t(gl_renderer_t &&other)
-  : mode_(other.mode_)
-  , handle_(std::move(other.handle_)) {}
+void
+gl_renderer_t::tearing(bool allow) {
+  tearing_ = allow;
+}
+
+bool
+gl_renderer_t::vrr(bool enable) {
+  return handle_.set_vrr(enable);
+}
 
-gl_renderer_t::~gl_renderer_t() {}
+bool
+gl_renderer_t::repeat(present_handler_t on_presented) {
+  // Whatever is on screen stays there, so must its buffers.
+  buffers_t buffers;
+  {
+    std::lock_guard<std::mutex> guard(scanout_mutex_);
+    buffers = on_screen_;
+  }
+  return handle_.repeat(on_flip(std::move(buffers), std::move(on_presented)));
+}
 
 void
-gl_renderer_t::bind() {
-  frontbuffer_ = handle_.acquire();
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  GL_CHECK;
+gl_renderer_t::flipped(const buffers_t &buffers) {
+  // What the flip took off the screen goes back to the client, once
+  // no one else holds it.  That happens outside of the lock.
+  buffers_t previous;
+  {
+    std::lock_guard<std::mutex> guard(scanout_mutex_);
+    previous   = std::move(on_screen_);
+    on_screen_ = buffers;
+  }
+}
+
+void
+gl_renderer_t::collect() {
+  std::vector<import_t> graveyard;
+  {
+    std::lock_guard<std::mutex> guard(scanout_mutex_);
+    graveyard.swap(graveyard_);
+  }
+
+  // Destroyed buffers are never on screen, we keep a reference to
+  // those that are.
+  for (auto &import : graveyard)
+    handle_.release(import);
+}
 
-  glViewport(0, 0, mode_.width(), mode_.height());
+template<typename _Fn>
+void
+gl_renderer_t::scissored(const region_t &bounds, _Fn &&fn) {
+  auto &gl = gl_state_t::current();
+  gl.scissor(true);
+  for (auto const &rect : clip_) {
+    if (!rect.intersects(bounds))
+      continue;
+
+    // GL's origin is the bottom left corner, ours the top left.
+    gl.scissor_box(rect.x, mode_.height() - (rect.y + rect.h), rect.w, rect.h);
+    fn();
+  }
+  gl.scissor(false);
   GL_CHECK;
 }
 
 void
-gl_renderer_t::commit() {
-  handle_.present(frontbuffer_);
+gl_renderer_t::clip(const std::vector<region_t> &rects) {
+  clip_ = rects;
 }
 
 void
 gl_renderer_t::clear(float r, float g, float b, float a) {
+  flush();
   glClearColor(r, g, b, a);
-  glClear(GL_COLOR_BUFFER_BIT);
+  scissored(region_t{ 0, 0, (int32_t)mode_.width(), (int32_t)mode_.height() },
+            [] { glClear(GL_COLOR_BUFFER_BIT); });
   GL_CHECK;
 }
 
-GLuint
-upload_texture(barock::shm_buffer_t &buffer) {
-  GLuint texture;
-  glGenTextures(1, &texture);
-  GL_CHECK;
+gl_texture_t
+gl_texture_cache_t::upload(surface_t &surface) {
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  auto [it, inserted] = textures_.try_emplace(&surface);
+  if (inserted) {
+    // The surface is destroyed on the wayland thread, where we have
+    // no context to delete the texture with; `collect' takes care of
+    // that on the next frame.
+    surface.events.on_destroy.connect([this](surface_t &surface) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (auto it = textures_.find(&surface); it != textures_.end()) {
+        if (it->second.shm.handle)
+          graveyard_.push_back(it->second.shm.handle);
+        textures_.erase(it);
+      }
+      return signal_action_t::eDelete;
+    });
+  }
 
-  glBindTexture(GL_TEXTURE_2D, texture);
-  GL_CHECK;
+  // What changed since our last upload.  The buffer is looked at
+  // afterwards, it is at least as recent as the damage then.
+  auto [damage, commit] = surface.damage_since(it->second.commit);
+  it->second.commit     = commit;
+  auto &buffer          = *surface.state.buffer;
+
+  // Drivers may refuse a shm buffer exported through udmabuf, those
+  // are still good for a copy.
+  if (buffer.dmabuf) {
+    auto texture = import(surface.state.buffer);
+    if (texture.handle != 0 || !buffer.pool)
+      return texture;
+  }
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  GL_CHECK;
+  auto &texture = it->second.shm;
+  if (texture.handle == 0) {
+    glGenTextures(1, &texture.handle);
+    GL_CHECK;
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  GL_CHECK;
+    gl_state_t::current().bind_texture(0, texture.handle);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GL_CHECK;
+  } else {
+    gl_state_t::current().bind_texture(0, texture.handle);
+    GL_CHECK;
+  }
 
   glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, buffer.stride / 4);
   GL_CHECK;
 
-  glTexImage2D(GL_TEXTURE_2D,
-               0,
-               GL_RGBA,
-               buffer.width,
-               buffer.height,
-               0,
-               GL_BGRA_EXT,
-               GL_UNSIGNED_BYTE,
-               buffer.data());
-  GL_CHECK;
+  if (texture.width != buffer.width || texture.height != buffer.height) {
+    // New texture, or the client resized its buffer, re-allocate the
+    // storage and upload everything.
+    glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_RGBA,
+                 buffer.width,
+                 buffer.height,
+                 0,
+                 GL_BGRA_EXT,
+                 GL_UNSIGNED_BYTE,
+                 buffer.data());
+    GL_CHECK;
+
+    texture.width  = buffer.width;
+    texture.height = buffer.height;
+  } else if (!damage.empty()) {
+    // Clients may damage outside of their buffer (or pass INT32_MAX
+    // to damage everything), clamp to what we can actually upload.
+    int32_t x0 = std::clamp(damage.x, 0, buffer.width);
+    int32_t y0 = std::clamp(damage.y, 0, buffer.height);
+    int32_t x1 = std::clamp<int64_t>((int64_t)damage.x + damage.w, 0, buffer.width);
+    int32_t y1 = std::clamp<int64_t>((int64_t)damage.y + damage.h, 0, buffer.height);
+
+    if (x1 > x0 && y1 > y0) {
+      glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x0);
+      glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y0);
+      glTexSubImage2D(GL_TEXTURE_2D,
+                      0,
+                      x0,
+                      y0,
+                      x1 - x0,
+                      y1 - y0,
+                      GL_BGRA_EXT,
+                      GL_UNSIGNED_BYTE,
+                      buffer.data());
+      GL_CHECK;
+
+      glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+      glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+    }
+  }
 
   glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
   GL_CHECK;
 
+  // Everything we need is in the texture now, the client may as well
+  // have the buffer back right away.  Saves it from allocating a
+  // third one while we hold on to this.
+  surface.copied(surface.state.buffer);
   return texture;
 }
 
+gl_texture_t
+gl_texture_cache_t::import(const shared_t<resource_t<shm_buffer_t>> &buffer) {
+  static auto create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+  static auto target_texture =
+    (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+
+  auto [it, inserted] =
+    images_.try_emplace(buffer.get(), image_t{ EGL_NO_IMAGE_KHR, { 0, 0, 0 } });
+  if (!inserted)
+    return it->second.texture;
+
+  // Clients cycle through a few buffers, the image lives as long as
+  // the buffer does.  Buffers that fail to import keep an empty entry,
+  // so we only try once.
+  buffer->on_destruct.connect([this](resource_t<shm_buffer_t> &buffer) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (auto it = images_.find(&buffer); it != images_.end()) {
+      if (it->second.texture.handle)
+        graveyard_.push_back(it->second.texture.handle);
+      if (it->second.image != EGL_NO_IMAGE_KHR)
+        image_graveyard_.push_back(it->second.image);
+      images_.erase(it);
+    }
+    return signal_action_t::eDelete;
+  });
+
+  if (!create_image || !target_texture) {
+    ERROR("EGL_EXT_image_dma_buf_import is not supported, can not sample dmabufs");
+    return it->second.texture;
+  }
+
+  static constexpr EGLint fd_attribs[] = { EGL_DMA_BUF_PLANE0_FD_EXT,
+                                           EGL_DMA_BUF_PLANE1_FD_EXT,
+                                           EGL_DMA_BUF_PLANE2_FD_EXT,
+                                           EGL_DMA_BUF_PLANE3_FD_EXT };
+  static constexpr EGLint offset_attribs[] = { EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+                                               EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+                                               EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+                                               EGL_DMA_BUF_PLANE3_OFFSET_EXT };
+  static constexpr EGLint pitch_attribs[] = { EGL_DMA_BUF_PLANE0_PITCH_EXT,
+                                              EGL_DMA_BUF_PLANE1_PITCH_EXT,
+                                              EGL_DMA_BUF_PLANE2_PITCH_EXT,
+                                              EGL_DMA_BUF_PLANE3_PITCH_EXT };
+  static constexpr EGLint modifier_attribs[][2] = {
+    { EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT },
+    { EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT },
+    { EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT },
+    { EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT }
+  };
+
+  auto               &dmabuf = *buffer->dmabuf;
+  std::vector<EGLint> attribs{ EGL_WIDTH,
+                               buffer->width,
+                               EGL_HEIGHT,
+                               buffer->height,
+                               EGL_LINUX_DRM_FOURCC_EXT,
+                               (EGLint)dmabuf.format };
+  for (uint32_t i = 0; i < dmabuf.num_planes; ++i) {
+    attribs.insert(attribs.end(),
+                   { fd_attribs[i],
+                     dmabuf.planes[i].fd,
+                     offset_attribs[i],
+                     (EGLint)dmabuf.planes[i].offset,
+                     pitch_attribs[i],
+                     (EGLint)dmabuf.planes[i].stride });
+
+    // An invalid modifier leaves the layout up to the driver
+    if (dmabuf.modifier != DRM_FORMAT_MOD_INVALID)
+      attribs.insert(attribs.end(),
+                     { modifier_attribs[i][0],
+                       (EGLint)(dmabuf.modifier & 0xffffffff),
+                       modifier_attribs[i][1],
+                       (EGLint)(dmabuf.modifier >> 32) });
+  }
+  attribs.push_back(EGL_NONE);
+
+  EGLImageKHR image = create_image(
+    eglGetCurrentDisplay(), EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attribs.data());
+  if (image == EGL_NO_IMAGE_KHR) {
+    WARN("Failed to import dmabuf {}x{} ({:#x}, modifier {:#x}): {:#x}",
+         buffer->width,
+         buffer->height,
+         dmabuf.format,
+         dmabuf.modifier,
+         eglGetError());
+    return it->second.texture;
+  }
+
+  GLuint handle;
+  glGenTextures(1, &handle);
+  gl_state_t::current().bind_texture(0, handle);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  target_texture(GL_TEXTURE_2D, image);
+  GL_CHECK;
+
+  it->second = image_t{ image, { handle, buffer->width, buffer->height } };
+  return it->second.texture;
+}
+
+void
+gl_texture_cache_t::collect() {
+  static auto destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!graveyard_.empty()) {
+    gl_state_t::current().delete_textures(graveyard_.size(), graveyard_.data());
+    GL_CHECK;
+    graveyard_.clear();
+  }
+
+  // Images go after their textures
+  for (auto image : image_graveyard_)
+    destroy_image(eglGetCurrentDisplay(), image);
+  image_graveyard_.clear();
+}
+
 GLuint
 upload_texture(int width, int height, void *data) {
   GLuint texture;
   glGenTextures(1, &texture);
   GL_CHECK;
 
-  glBindTexture(GL_TEXTURE_2D, texture);
+  gl_state_t::current().bind_texture(0, texture);
   GL_CHECK;
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -258,72 +850,178 @@ upload_texture(int width, int height, void *data) {
 }
 
 void
-quad(const gl_shader_t &shader, GLuint texture) {
-  static const GLfloat vertices[] = { // X,  Y,   U,  V
-                                      0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,
-                                      0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f
+gl_renderer_t::push(GLuint          texture,
+                    const fpoint_t &position,
+                    const fpoint_t &size,
+                    const region_t &opaque) {
+  if (size.x <= 0.f || size.y <= 0.f)
+    return;
+
+  // Every clip rectangle may cut up to five quads, see below
+  if (batch_.size() / 4 + clip_.size() * 5 > BATCH_QUADS)
+    flush();
+
+  auto unit = std::find(batch_textures_.begin(), batch_textures_.end(), texture);
+  if (unit == batch_textures_.end()) {
+    if (batch_textures_.size() == BATCH_TEXTURES)
+      flush();
+    batch_textures_.push_back(texture);
+    unit = batch_textures_.end() - 1;
+  }
+  GLfloat index = unit - batch_textures_.begin();
+
+  auto quad = [&](GLfloat x0, GLfloat y0, GLfloat x1, GLfloat y1, bool blend) {
+    if (x1 <= x0 || y1 <= y0)
+      return;
+
+    GLfloat u0 = (x0 - position.x) / size.x, u1 = (x1 - position.x) / size.x;
+    GLfloat v0 = (y0 - position.y) / size.y, v1 = (y1 - position.y) / size.y;
+    batch_.push_back({ x0, y0, u0, v0, index });
+    batch_.push_back({ x1, y0, u1, v0, index });
+    batch_.push_back({ x0, y1, u0, v1, index });
+    batch_.push_back({ x1, y1, u1, v1, index });
+
+    if (runs_.empty() || runs_.back().blend != blend)
+      runs_.push_back({ 0, blend });
+    ++runs_.back().quads;
   };
 
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  // The opaque part, in screen space
+  GLfloat ox0 = position.x + opaque.x, ox1 = ox0 + std::max(opaque.w, 0);
+  GLfloat oy0 = position.y + opaque.y, oy1 = oy0 + std::max(opaque.h, 0);
+
+  // Clip on the CPU rather than with the scissor box, so the quads of
+  // all rectangles go into the same draw call.  Only the bands around
+  // the opaque part are blended; they go first, so the quads of one
+  // surface take no more than two draw calls.
+  for (bool blend : { true, false }) {
+    for (auto const &rect : clip_) {
+      GLfloat x0 = std::max<GLfloat>(position.x, rect.x);
+      GLfloat y0 = std::max<GLfloat>(position.y, rect.y);
+      GLfloat x1 = std::min<GLfloat>(position.x + size.x, rect.x + rect.w);
+      GLfloat y1 = std::min<GLfloat>(position.y + size.y, rect.y + rect.h);
+      if (x1 <= x0 || y1 <= y0)
+        continue;
+
+      GLfloat cx0 = std::clamp(ox0, x0, x1), cx1 = std::clamp(ox1, x0, x1);
+      GLfloat cy0 = std::clamp(oy0, y0, y1), cy1 = std::clamp(oy1, y0, y1);
+      if (cx1 <= cx0 || cy1 <= cy0) {
+        if (blend)
+          quad(x0, y0, x1, y1, true);
+      } else if (blend) {
+        quad(x0, y0, x1, cy0, true);
+        quad(x0, cy1, x1, y1, true);
+        quad(x0, cy0, cx0, cy1, true);
+        quad(cx1, cy0, x1, cy1, true);
+      } else {
+        quad(cx0, cy0, cx1, cy1, false);
+      }
+    }
+  }
+}
+
+void
+gl_renderer_t::flush() {
+  if (batch_.empty()) {
+    batch_textures_.clear();
+    return;
+  }
+
+  auto &gl = gl_state_t::current();
+  if (vbo_ == 0) {
+    // The quads share their index buffer, it never changes.
+    std::vector<GLushort> indices;
+    indices.reserve(BATCH_QUADS * 6);
+    for (GLushort i = 0; i < BATCH_QUADS * 4; i += 4) {
+      GLushort quad[] = { i, (GLushort)(i + 1), (GLushort)(i + 2),
+                          (GLushort)(i + 2), (GLushort)(i + 1), (GLushort)(i + 3) };
+      indices.insert(indices.end(), std::begin(quad), std::end(quad));
+    }
+
+    glGenBuffers(1, &vbo_);
+    glGenBuffers(1, &ibo_);
+    gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 indices.size() * sizeof(GLushort),
+                 indices.data(),
+                 GL_STATIC_DRAW);
+    GL_CHECK;
+  }
 
-  GLuint attr_pos = glGetAttribLocation(shader, "a_position");
-  GLuint attr_tex = glGetAttribLocation(shader, "a_texcoord");
-  GLuint u_tex    = glGetUniformLocation(shader, "u_texture");
+  auto &program = singleton_t<gl_quad_program_t>::get();
+  gl.use_program(program);
+  glUniform2f(program.uniform<gl_quad_layout_t::uScreenSize>(), mode_.width(), mode_.height());
+  GL_CHECK;
 
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glUniform1i(u_tex, 0);
+  for (size_t i = 0; i < batch_textures_.size(); ++i)
+    gl.bind_texture(i, batch_textures_[i]);
 
-  glEnableVertexAttribArray(attr_pos);
-  glEnableVertexAttribArray(attr_tex);
+  // Orphan the storage of the last frame rather than waiting for the
+  // GPU to be done with it.
+  gl.bind_buffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferData(GL_ARRAY_BUFFER, BATCH_QUADS * 4 * sizeof(vertex_t), nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, batch_.size() * sizeof(vertex_t), batch_.data());
+  gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+  GL_CHECK;
 
-  // CPU pointer source, valid because VBO=0
+  // Nothing else draws with vertex arrays, they stay enabled.
+  GLuint attr_pos = gl_quad_layout_t::aPosition;
+  GLuint attr_uv  = gl_quad_layout_t::aTexcoord;
+  GLuint attr_tex = gl_quad_layout_t::aTexture;
+  gl.attributes((1u << attr_pos) | (1u << attr_uv) | (1u << attr_tex));
   glVertexAttribPointer(
-    attr_pos, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const void *)(&vertices[0]));
+    attr_pos, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (const void *)offsetof(vertex_t, x));
   glVertexAttribPointer(
-    attr_tex, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const void *)(&vertices[2]));
-
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    attr_uv, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (const void *)offsetof(vertex_t, u));
+  glVertexAttribPointer(
+    attr_tex, 1, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (const void *)offsetof(vertex_t, texture));
+
+  GLsizei first = 0;
+  for (auto const &run : runs_) {
+    gl.blend(run.blend);
+    glDrawElements(GL_TRIANGLES,
+                   run.quads * 6,
+                   GL_UNSIGNED_SHORT,
+                   (const void *)(first * 6 * sizeof(GLushort)));
+    first += run.quads;
+  }
+  GL_CHECK;
 
-  glDisableVertexAttribArray(attr_pos);
-  glDisableVertexAttribArray(attr_tex);
+  batch_.clear();
+  runs_.clear();
+  batch_textures_.clear();
+  if (!transient_.empty()) {
+    gl.delete_textures(transient_.size(), transient_.data());
+    transient_.clear();
+  }
 }
 
 void
 gl_renderer_t::draw(surface_t &surface, const fpoint_t &screen_position) {
-  glViewport(0, 0, mode_.width(), mode_.height());
   if (surface.state.buffer) {
-    GLuint texture = upload_texture(*surface.state.buffer);
-    GL_CHECK;
-
-    auto quad_shader = singleton_t<gl_shader_storage_t>::get().by_name("quad shader");
-    quad_shader.bind();
-    GL_CHECK;
-
-    quad_shader.uniform("u_surface_position", screen_position.x, screen_position.y);
-    quad_shader.uniform("u_surface_size", surface.extent().x, surface.extent().y);
-    quad_shader.uniform("u_screen_size", mode_.width(), mode_.height());
-
-    quad(quad_shader, texture);
-
-    glDeleteTextures(1, &texture);
-    GL_CHECK;
-
-    // Send the frame callback, and release the buffer back to the
-    // client.
-    if (surface.state.pending) {
-      wl_callback_send_done(surface.state.pending, current_time_msec());
-      wl_resource_destroy(surface.state.pending);
-      wl_buffer_send_release(surface.state.buffer->resource());
-      surface.state.pending = nullptr;
-    }
+    // Sampled in place, the buffer has to stay with us until the frame
+    // is off the screen, even if the client attaches another one.
+    if (surface.state.buffer->dmabuf)
+      sampled_.emplace_back(surface.state.buffer);
+    auto texture = singleton_t<gl_texture_cache_t>::get().upload(surface);
+
+    // A dmabuf that failed to import is left out, the client was
+    // told it is fine already.
+    if (texture.handle != 0)
+      push(texture.handle, screen_position, surface.extent().to<float>(), surface.opaque_region());
+
+    // The texture cache gives the buffer back, the frame callback is
+    // sent once the frame is actually on screen.
+    if (surface.frame_pending())
+      surface.frame_drawn();
   }
 
-  for (auto &subsurface_dao : surface.state.children) {
-    if (auto subsurface = subsurface_dao->surface.lock(); subsurface) {
+  auto stacking = surface.stacking();
+  for (auto &subsurface_dao : *stacking) {
+    if (auto subsurface = subsurface_dao.surface.lock(); subsurface) {
       draw(*subsurface,
-           { screen_position.x + subsurface_dao->position.x,
-             screen_position.y + subsurface_dao->position.y });
+           { screen_position.x + subsurface_dao.position.x,
+             screen_position.y + subsurface_dao.position.y });
     }
   }
 }
@@ -333,19 +1031,19 @@ gl_renderer_t::draw(_XcursorImage *cursor, const fpoint_t &screen_position) {
   assert(cursor != nullptr);
   GLuint texture = upload_texture(cursor->width, cursor->height, cursor->pixels);
 
-  auto quad_shader = singleton_t<gl_shader_storage_t>::get().by_name("quad shader");
-  quad_shader.bind();
-  GL_CHECK;
+  // The texture has to outlive the batch
+  transient_.push_back(texture);
 
-  quad_shader.uniform(
-    "u_surface_position", screen_position.x - cursor->xhot, screen_position.y - cursor->yhot);
-  quad_shader.uniform("u_surface_position", screen_position.x, screen_position.y);
-  quad_shader.uniform("u_surface_size", cursor->width, cursor->height);
-  quad_shader.uniform("u_screen_size", mode_.width(), mode_.height());
+  fpoint_t position{ screen_position.x - cursor->xhot, screen_position.y - cursor->yhot };
+  push(texture, position, fpoint_t{ (float)cursor->width, (float)cursor->height });
+}
 
-  quad(quad_shader, texture);
-  GL_CHECK;
+bool
+gl_renderer_t::cursor(const uint32_t *pixels, const ipoint_t &size, uint32_t stride) {
+  return handle_.set_cursor(pixels, size.x, size.y, stride);
+}
 
-  glDeleteTextures(1, &texture);
-  GL_CHECK;
+void
+gl_renderer_t::move_cursor(const ipoint_t &screen_position) {
+  handle_.move_cursor(screen_position.x, screen_position.y);
 }
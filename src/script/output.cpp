@@ -2,6 +2,7 @@
 
 #include "barock/compositor.hpp"
 #include "barock/core/output_manager.hpp"
+#include "barock/render/opengl.hpp"
 #include "barock/script/interop.hpp"
 #include "barock/script/janet.hpp"
 #include "barock/singleton.hpp"
@@ -33,6 +34,7 @@ namespace barock {
 
       janet_table_put(
         table, janet_ckeywordv("refresh-rate"), janet_wrap_number(output.mode().refresh_rate()));
+      janet_table_put(table, janet_ckeywordv("vrr"), janet_wrap_boolean(output.vrr()));
 
       std::string connector_name = output.connector().name();
       janet_table_put(
@@ -114,36 +116,18 @@ parse_mode_line(const std::string &line) {
   return jsl::result_t<mode_setting_t, std::string>::ok(setting);
 }
 
-JANET_CFUN(cfun_output_configure) {
-  janet_fixarity(argc, 2);
-
-  auto connector  = janet_getkeyword(argv, 0);
-  auto parameters = janet_gettable(argv, 1);
-
-  auto &compositor = singleton_t<compositor_t>::get();
-  auto  output     = compositor.registry_.output->by_name((const char *)connector);
-
-  if (output.valid() == false) {
-    ERROR("(output/configure :{}) Unknown output '{}'",
-          (const char *)connector,
-          (const char *)connector);
-    return janet_wrap_false();
-  }
-
-  // Else, we can parse the parameters table
-  janet_table_get(parameters, janet_ckeywordv("mode"));
-
-  auto mode_opt       = janet_table_get(parameters, janet_ckeywordv("mode"));
+static bool
+configure_mode(compositor_t &compositor, output_t &output, const char *connector, Janet mode_opt) {
   auto preferred_mode = parse_mode_line(janet_getcstring(&mode_opt, 0));
 
   if (!preferred_mode.valid()) {
     ERROR("{}", preferred_mode.error());
-    return janet_wrap_false();
+    return false;
   }
 
   // List the modes we have, and try to match either the exact one, or
   // the preferred.
-  auto &drm_connector = output->connector();
+  auto &drm_connector = output.connector();
   auto  modes         = drm_connector.modes();
   auto  best_match    = modes.end();
 
@@ -161,16 +145,65 @@ JANET_CFUN(cfun_output_configure) {
   }
 
   if (best_match == modes.end()) {
-    ERROR("Could not match any mode based on the configuration for {}!", (const char *)connector);
-    return janet_wrap_false();
+    ERROR("Could not match any mode based on the configuration for {}!", connector);
+    return false;
   }
 
-  compositor.registry_.output->configure(*output, *best_match);
+  compositor.registry_.output->configure(output, *best_match);
   INFO("Configured '{}' to use mode {}x{} @ {} Hz",
-       (const char *)connector,
+       connector,
        best_match->width(),
        best_match->height(),
        best_match->refresh_rate());
+  return true;
+}
+
+JANET_CFUN(cfun_output_configure) {
+  janet_fixarity(argc, 2);
+
+  auto connector  = janet_getkeyword(argv, 0);
+  auto parameters = janet_gettable(argv, 1);
+
+  auto &compositor = singleton_t<compositor_t>::get();
+  auto  output     = compositor.registry_.output->by_name((const char *)connector);
+
+  if (output.valid() == false) {
+    ERROR("(output/configure :{}) Unknown output '{}'",
+          (const char *)connector,
+          (const char *)connector);
+    return janet_wrap_false();
+  }
+
+  // Else, we can parse the parameters table, every parameter is
+  // optional.
+  auto mode_opt = janet_table_get(parameters, janet_ckeywordv("mode"));
+  if (!janet_checktype(mode_opt, JANET_NIL) &&
+      !configure_mode(compositor, *output, (const char *)connector, mode_opt))
+    return janet_wrap_false();
+
+  // Tearing stays opt-in, and then only for fullscreen clients that
+  // ask for it.
+  auto tearing = janet_table_get(parameters, janet_ckeywordv("tearing"));
+  if (!janet_checktype(tearing, JANET_NIL)) {
+    output->tearing(janet_truthy(tearing));
+    INFO("{} tearing on '{}'",
+         janet_truthy(tearing) ? "Allowed" : "Disallowed",
+         (const char *)connector);
+  }
+
+  // Takes effect with the next mode set, which is why it has to be
+  // configured up front.
+  auto buffers = janet_table_get(parameters, janet_ckeywordv("buffers"));
+  if (!janet_checktype(buffers, JANET_NIL)) {
+    output->backbuffers(janet_getinteger(&buffers, 0));
+    INFO("Using {} backbuffers on '{}'", output->backbuffers(), (const char *)connector);
+  }
+
+  auto vrr = janet_table_get(parameters, janet_ckeywordv("vrr"));
+  if (!janet_checktype(vrr, JANET_NIL)) {
+    output->vrr(janet_truthy(vrr));
+    INFO("{} VRR on '{}'", janet_truthy(vrr) ? "Enabled" : "Disabled", (const char *)connector);
+  }
 
   // Test for screen arrangement
   std::map<const char *, direction_t> adjacent_map = {
@@ -234,16 +267,24 @@ JANET_CFUN(cfun_output_pan) {
   return janet_wrap_true();
 }
 
+JANET_CFUN(cfun_output_gl_saved_calls) {
+  janet_fixarity(argc, 0);
+
+  return janet_wrap_number(gl_state_t::saved());
+}
+
 void
 janet_module_t<output_manager_t>::import(JanetTable *env) {
   constexpr static JanetReg output_manager_fns[] = {
     { "output/configure",
-     cfun_output_configure,          "(output/configure output parameters)\n\nConfigure `output' with parameters"       },
+     cfun_output_configure,          "(output/configure output parameters)\n\nConfigure `output' with parameters, i.e. :mode \"WxH@R\", :buffers 3, :tearing true or :vrr true"       },
     {       "output/get",
      cfun_output_get,   "(output/get connector-name)\n\nReturn an object containing information about the output at "
    "connector `connector-name'.\nReturns nil, when the output couldn't be found."                  },
     {       "output/pan",
      cfun_output_pan, "(output/pan output [x y] &opt skip-animation)\n\nSet the workspace pan to [`x' `y']"             },
+    { "output/gl-saved-calls",
+     cfun_output_gl_saved_calls, "(output/gl-saved-calls)\n\nReturn the number of redundant GL state changes that were skipped"  },
     {            nullptr, nullptr,                                                                               nullptr }
   };
   janet_cfuns(env, "barock", output_manager_fns);
@@ -87,6 +87,7 @@ JANET_CFUN(cfun_xdg_set_position) {
 
   (*window)->position.x = point.x;
   (*window)->position.y = point.y;
+  output->force_render();
   return janet_wrap_true();
 }
 
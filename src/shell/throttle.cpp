@@ -0,0 +1,16 @@
+#include "barock/shell/throttle.hpp"
+
+namespace barock {
+  bool
+  covered(std::span<const window_cover_t> windows, size_t index) {
+    auto const &bounds = windows[index].bounds;
+    for (size_t i = 0; i < index; ++i) {
+      // Translucent parts, like the shadows of client side
+      // decorations, don't hide anything.
+      auto const &opaque = windows[i].opaque;
+      if (!opaque.empty() && (bounds - opaque) == bounds)
+        return true;
+    }
+    return false;
+  }
+}
@@ -194,6 +194,8 @@ xdg_toplevel_move(wl_client   *client,
 
       state->surface->position.x = state->win_x + static_cast<int>(dx);
       state->surface->position.y = state->win_y + static_cast<int>(dy);
+      if (state->surface->output)
+        state->surface->output->force_render();
       return signal_action_t::eOk;
     });
 
@@ -1,13 +1,17 @@
 #include "barock/shell/xdg_wm_base.hpp"
 #include "barock/compositor.hpp"
 
+#include "barock/core/cursor_manager.hpp"
+#include "barock/core/event_loop.hpp"
 #include "barock/core/renderer.hpp"
 #include "barock/core/shm_pool.hpp"
 #include "barock/core/surface.hpp"
 #include "barock/script/janet.hpp"
+#include "barock/shell/throttle.hpp"
 #include "barock/shell/xdg_surface.hpp"
 #include "barock/shell/xdg_toplevel.hpp"
 #include "barock/singleton.hpp"
+#include "barock/util.hpp"
 
 #include "../log.hpp"
 #include "wl/xdg-shell-protocol.h"
@@ -33,6 +37,48 @@ struct xdg_wm_base_interface xdg_wm_base_impl = {
 
 namespace barock {
 
+  /**
+   * @brief Where `windows' are and what of them is opaque, top most
+   * first, see `covered'.
+   */
+  static std::vector<window_cover_t>
+  covers(xdg_window_list_t &windows) {
+    std::vector<window_cover_t> covers;
+    covers.reserve(windows.size());
+    for (auto &xdg_surface : windows) {
+      covers.push_back({ .bounds = { 0, 0, 0, 0 }, .opaque = { 0, 0, 0, 0 } });
+      auto &cover   = covers.back();
+      auto  surface = xdg_surface->surface.lock();
+      if (!surface)
+        continue;
+
+      auto origin  = (xdg_surface->position - xdg_surface->offset).to<int>();
+      cover.bounds = region_t{ origin, surface->full_extent() };
+      if (surface->state.buffer) {
+        cover.opaque    = surface->opaque_region();
+        cover.opaque.x += origin.x;
+        cover.opaque.y += origin.y;
+      }
+    }
+    return covers;
+  }
+
+  /**
+   * @brief Whether the window at `index' can't be seen on `output', it is either
+   * off screen or covered entirely by the opaque region of a window above it.
+   */
+  static bool
+  hidden(const output_t                 &output,
+         xdg_window_list_t              &windows,
+         std::span<const window_cover_t> covers,
+         size_t                          index) {
+    auto &xdg_surface = windows[index];
+    if (!xdg_surface->surface.lock() ||
+        !output.is_visible({ xdg_surface->position, xdg_surface->size }))
+      return true;
+    return covered(covers, index);
+  }
+
   xdg_shell_t::~xdg_shell_t() {}
 
   xdg_shell_t::xdg_shell_t(wl_display *display, service_registry_t &registry)
@@ -40,6 +86,9 @@ namespace barock {
     , registry(registry) {
     wl_global_create(display, &xdg_wm_base_interface, 1, this, bind);
 
+    throttle_ = registry.event_loop->add_timer(throttle, this);
+    wl_event_source_timer_update(throttle_, HIDDEN_FRAME_MSEC);
+
     for (auto &out : registry.output->outputs()) {
       on_output_new(*out);
     }
@@ -57,6 +106,111 @@ namespace barock {
     // We also have to attach our `repaint` listener, that actually draws the windows
     output.events.on_repaint[XDG_SHELL_PAINT_LAYER].connect(
       std::bind(&xdg_shell_t::paint, this, std::placeholders::_1));
+
+    output.events.on_scanout[XDG_SHELL_PAINT_LAYER].connect(std::bind(
+      &xdg_shell_t::scanout, this, std::placeholders::_1, std::placeholders::_2));
+    output.events.on_overlay[XDG_SHELL_PAINT_LAYER].connect(std::bind(
+      &xdg_shell_t::overlay, this, std::placeholders::_1, std::placeholders::_2));
+
+    // Frame callbacks are completed once the frame is on screen
+    output.events.on_present.connect(
+      std::bind(&xdg_shell_t::present, this, std::placeholders::_1, std::placeholders::_2));
+    return signal_action_t::eOk;
+  }
+
+  signal_action_t
+  xdg_shell_t::present(output_t &output, const presentation_t &presentation) {
+    auto &windows = output.metadata.get<xdg_window_list_t>();
+    for (auto &xdg_surface : windows) {
+      if (auto surface = xdg_surface->surface.lock(); surface)
+        surface->frame_done(output, presentation);
+    }
+    return signal_action_t::eOk;
+  }
+
+  int
+  xdg_shell_t::throttle(void *ud) {
+    auto *shell = static_cast<xdg_shell_t *>(ud);
+
+    // Hidden windows are not drawn, so nothing would ever complete
+    // their frame callbacks.  Let them render at a trickle instead, as
+    // long as no output shows them at all.
+    frame_throttle_t<shared_t<resource_t<surface_t>>> waiting;
+    for (auto &output : shell->registry.output->outputs()) {
+      auto &windows = output->metadata.get<xdg_window_list_t>();
+      auto  cover   = covers(windows);
+      for (size_t i = 0; i < windows.size(); ++i) {
+        auto surface = windows[i]->surface.lock();
+        if (surface && surface->frame_pending())
+          waiting.waiting(surface, !hidden(*output, windows, cover, i));
+      }
+    }
+
+    auto now = current_time_msec();
+    for (auto &surface : waiting.hidden())
+      surface->frame_skip(now);
+
+    wl_event_source_timer_update(shell->throttle_, HIDDEN_FRAME_MSEC);
+    return 0;
+  }
+
+  signal_action_t
+  xdg_shell_t::scanout(output_t &output, surface_t *&candidate) {
+    auto &windows = output.metadata.get<xdg_window_list_t>();
+    if (windows.empty())
+      return signal_action_t::eOk;
+
+    // Only the top most window can cover everything else
+    auto &xdg_surface = windows.front();
+    auto  surface     = xdg_surface->surface.lock();
+    if (!surface || !surface->state.buffer || !surface->stacking()->empty())
+      return signal_action_t::eOk;
+
+    auto     position = output.to<output_t::eWorkspace, output_t::eScreenspace>(
+      xdg_surface->position - xdg_surface->offset);
+    region_t screen{ 0, 0, (int32_t)output.mode().width(), (int32_t)output.mode().height() };
+    if (region_t{ position.to<int>(), surface->extent() } != screen)
+      return signal_action_t::eOk;
+
+    // Whatever is below has to be hidden, the plane won't blend.
+    region_t local{ ipoint_t{ 0, 0 }, surface->extent() };
+    if (surface->opaque_region() != local)
+      return signal_action_t::eOk;
+
+    candidate = surface.get();
+    return signal_action_t::eOk;
+  }
+
+  signal_action_t
+  xdg_shell_t::overlay(output_t &output, std::vector<plane_assignment_t> &candidates) {
+    region_t screen{ 0, 0, (int32_t)output.mode().width(), (int32_t)output.mode().height() };
+    std::vector<region_t> above; ///< Windows on top of the current one
+
+    auto &windows = output.metadata.get<xdg_window_list_t>();
+    for (auto &xdg_surface : windows) {
+      auto surface = xdg_surface->surface.lock();
+      if (!surface)
+        continue;
+
+      auto     position = output.to<output_t::eWorkspace, output_t::eScreenspace>(
+        xdg_surface->position - xdg_surface->offset);
+      region_t bounds{ position.to<int>(), surface->full_extent() };
+
+      // The planes are stacked above the composited frame, a window
+      // that is covered by another one has to stay in it.  So does
+      // anything the plane can't show in full.
+      bool occluded = std::any_of(
+        above.begin(), above.end(), [&bounds](auto const &rect) { return rect.intersects(bounds); });
+      above.push_back(bounds);
+      if (occluded || (bounds - screen) != bounds || !surface->state.buffer ||
+          !surface->stacking()->empty())
+        continue;
+
+      // Planes don't blend with what is below
+      region_t local{ ipoint_t{ 0, 0 }, surface->extent() };
+      if (surface->opaque_region() == local)
+        candidates.push_back({ .surface = surface.get(), .bounds = bounds });
+    }
     return signal_action_t::eOk;
   }
 
@@ -65,33 +219,29 @@ namespace barock {
     auto renderer = &output.renderer();
 
     auto &windows = output.metadata.get<xdg_window_list_t>();
+    auto  cover   = covers(windows);
     for (auto it = windows.rbegin(); it != windows.rend(); ++it) {
       auto &xdg_surface = *it;
       if (auto surface = xdg_surface->surface.lock(); surface) {
-        // Cull windows that are not visible
-        if (output.is_visible({ xdg_surface->position, xdg_surface->size }) == false) {
-          WARN("Window is not visible. Culling.");
+        // Cull windows that are off screen or covered, their frame
+        // callbacks are left to the throttle.
+        if (hidden(output, windows, cover, std::distance(it, windows.rend()) - 1))
           continue;
-        }
-
-        // Check if we have damage
-        //
-        // TODO: This requires clipping, we do not have that yet and
-        // have to re-render everything whenever `on_repaint' is
-        // emitted.
-
-        // if (output.damaged(region_t{
-        //       output.to<output_t::eWorkspace, output_t::eScreenspace>(xdg_surface->position),
-        //       xdg_surface->size }) == false) {
-        //   // No damage, means we skip it.
-        //   WARN("Window not within any damage region, skipping...");
-        //   continue;
-        // }
 
         // Subtract our offset for client side decoration
         auto position = output.to<output_t::eWorkspace, output_t::eScreenspace>(
           xdg_surface->position - xdg_surface->offset);
 
+        // Skip windows that do not intersect the damage of this frame,
+        // unless they still wait for their frame callback.
+        if (output.damaged(region_t{ position.to<int>(), surface->full_extent() }) == false &&
+            !surface->frame_pending())
+          continue;
+
+        // The display engine shows it for us
+        if (output.on_plane(*surface))
+          continue;
+
         renderer->draw(*surface, position);
       }
     }
@@ -205,6 +355,40 @@ namespace barock {
     return nullptr;
   }
 
+  void
+  xdg_shell_t::map(shared_t<xdg_surface_t> xdg_surface) {
+    for (auto &output : registry.output->outputs()) {
+      auto &windows = output->metadata.get<xdg_window_list_t>();
+      if (std::find(windows.begin(), windows.end(), xdg_surface) != windows.end())
+        return;
+    }
+
+    auto &output        = registry.cursor->current_output();
+    xdg_surface->output = &output;
+    auto &windows       = output.metadata.get<xdg_window_list_t>();
+    windows.insert(windows.begin(), xdg_surface);
+  }
+
+  void
+  xdg_shell_t::unmap(const xdg_surface_t &xdg_surface) {
+    auto surface = xdg_surface.surface.lock();
+    for (auto &output : registry.output->outputs()) {
+      auto &windows = output->metadata.get<xdg_window_list_t>();
+      auto  it      = std::find_if(windows.begin(), windows.end(), [&xdg_surface](auto &window) {
+        return window.get() == &xdg_surface;
+      });
+      if (it == windows.end())
+        continue;
+
+      if (surface) {
+        auto position = output->to<output_t::eWorkspace, output_t::eScreenspace>(
+          xdg_surface.position - xdg_surface.offset);
+        output->damage(region_t{ position.to<int>(), surface->full_extent() });
+      }
+      windows.erase(it);
+    }
+  }
+
   void
   xdg_shell_t::raise_to_top(shared_t<xdg_surface_t> surface, jsl::optional_t<output_t &> output) {
     auto raise = +[](output_t &output, shared_t<xdg_surface_t> surface) {
@@ -214,6 +398,7 @@ namespace barock {
       if (it != windows.end()) {
         windows.erase(it);
         windows.insert(windows.begin(), surface);
+        output.force_render();
       }
     };
 
@@ -266,32 +451,73 @@ xdg_wm_base_get_xdg_surface(wl_client   *client,
     // Add the damage to our output
     jsl::optional_t<const output_t &> output;
     auto                             &root     = surface.root();
-    auto                              position = surface.position();
+    fpoint_t                          position = surface.position().to<float>();
 
     // Find the root toplevel window
     for (auto const &current_output : shell->registry.output->outputs()) {
       auto &windows = current_output->metadata.get<xdg_window_list_t>();
 
-      auto it = std::find_if(windows.begin(), windows.end(), [&surface](auto &toplevel) {
-        return shared_cast<surface_t>(toplevel->surface.lock()).get() == &surface;
+      auto it = std::find_if(windows.begin(), windows.end(), [&root](auto &toplevel) {
+        return shared_cast<surface_t>(toplevel->surface.lock()).get() == &root;
       });
 
       if (it != windows.end()) {
         output.emplace(*current_output);
-        position += (*it)->position + (*it)->offset;
+        position += (*it)->position - (*it)->offset;
       }
     }
 
     if (output.valid() == true) {
-      // output->damage(region_t{ (int)position.x, (int)position.y, region.w, region.h });
-      output->force_render();
-      // TRACE("Added damage onto output {}", output->connector().name());
+      // The surface clamped the damage of the client already.  Ours
+      // may cover more than the buffer, it is where the old one was.
+      auto     screen = output->to<output_t::eWorkspace, output_t::eScreenspace>(position);
+      region_t rect{ (int)screen.x + region.x, (int)screen.y + region.y, region.w, region.h };
+      output->damage(surface, rect);
     } else {
       ERROR("Got damage event on surface that isn't being displayed on any output.");
     }
     return signal_action_t::eOk;
   });
 
+  surface->events.on_frame.connect([shell](auto &surface) {
+    // Nothing changed on screen, but the outputs showing the window
+    // still owe it a frame.
+    auto &root = surface.root();
+    for (auto const &output : shell->registry.output->outputs()) {
+      auto &windows = output->metadata.get<xdg_window_list_t>();
+      bool  shown   = std::any_of(windows.begin(), windows.end(), [&root](auto &toplevel) {
+        return shared_cast<surface_t>(toplevel->surface.lock()).get() == &root;
+      });
+      if (shown)
+        output->frame_requested();
+    }
+    return signal_action_t::eOk;
+  });
+
+  // Unmapped windows leave the window list, until they attach a
+  // buffer again.  Destroyed ones leave for good.
+  surface->events.on_buffer_detach.connect(
+    [shell, weak = weak_t<resource_t<xdg_surface_t>>(xdg_surface)](surface_t &) {
+      auto xdg_surface = weak.lock();
+      if (!xdg_surface)
+        return signal_action_t::eDelete;
+      shell->unmap(*xdg_surface);
+      return signal_action_t::eOk;
+    });
+  surface->events.on_buffer_attach.connect(
+    [shell, weak = weak_t<resource_t<xdg_surface_t>>(xdg_surface)](shm_buffer_t &) {
+      auto xdg_surface = weak.lock();
+      if (!xdg_surface)
+        return signal_action_t::eDelete;
+      if (xdg_surface->role == xdg_role_t::eToplevel)
+        shell->map(xdg_surface);
+      return signal_action_t::eOk;
+    });
+  xdg_surface->on_destroy.connect([shell, self = xdg_surface.get()](wl_resource *) {
+    shell->unmap(*self);
+    return signal_action_t::eOk;
+  });
+
   surface->role = xdg_surface;
 
   // Send the configure event
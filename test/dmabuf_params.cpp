@@ -0,0 +1,116 @@
+#include "barock/dmabuf/params.hpp"
+#include "wl/linux-dmabuf-v1-protocol.h"
+
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace barock;
+
+namespace {
+  constexpr uint32_t FORMAT = 0x34325241; ///< ARGB8888
+
+  /// Params backed by memfds of a known size, they stand in for dmabufs
+  struct params_test_t : public ::testing::Test {
+    dmabuf_params_t  params;
+    std::vector<int> fds;
+
+    int
+    buffer(off_t size) {
+      int fd = memfd_create("dmabuf_params", MFD_CLOEXEC);
+      EXPECT_GE(fd, 0);
+      EXPECT_EQ(ftruncate(fd, size), 0);
+      fds.push_back(fd);
+      return fd;
+    }
+
+    ~params_test_t() override {
+      for (int fd : fds)
+        close(fd);
+    }
+  };
+
+  uint32_t
+  code(const std::optional<params_error_t> &error) {
+    return error ? error->code : UINT32_MAX;
+  }
+}
+
+TEST_F(params_test_t, single_plane) {
+  EXPECT_FALSE(params.add(buffer(64 * 64 * 4), 0, 0, 64 * 4, 0, true));
+  EXPECT_FALSE(params.check(64, 64, FORMAT, true));
+  EXPECT_TRUE(params.used);
+}
+
+TEST_F(params_test_t, plane_index_out_of_bounds) {
+  EXPECT_EQ(code(params.add(buffer(16), dmabuf_attributes_t::MAX_PLANES, 0, 4, 0, true)),
+            ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX);
+  EXPECT_EQ(params.added, 0u);
+}
+
+TEST_F(params_test_t, plane_set_twice) {
+  EXPECT_FALSE(params.add(buffer(16), 0, 0, 4, 0, true));
+  EXPECT_EQ(code(params.add(buffer(16), 0, 0, 4, 0, true)),
+            ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET);
+}
+
+TEST_F(params_test_t, modifiers_have_to_match_since_version_5) {
+  EXPECT_FALSE(params.add(buffer(16), 0, 0, 4, 1, true));
+  EXPECT_EQ(code(params.add(buffer(16), 1, 0, 4, 2, true)),
+            ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT);
+  EXPECT_FALSE(params.add(buffer(16), 1, 0, 4, 2, false));
+}
+
+TEST_F(params_test_t, planes_have_to_be_consecutive) {
+  EXPECT_EQ(code(params.check(1, 1, FORMAT, true)), ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE);
+
+  dmabuf_params_t gap;
+  EXPECT_FALSE(gap.add(buffer(16), 1, 0, 4, 0, true));
+  EXPECT_EQ(code(gap.check(1, 1, FORMAT, true)), ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE);
+}
+
+TEST_F(params_test_t, used_only_once) {
+  EXPECT_FALSE(params.add(buffer(16), 0, 0, 4, 0, true));
+  EXPECT_FALSE(params.check(2, 2, FORMAT, true));
+  EXPECT_EQ(code(params.check(2, 2, FORMAT, true)), ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED);
+  EXPECT_EQ(code(params.add(buffer(16), 1, 0, 4, 0, true)),
+            ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED);
+}
+
+TEST_F(params_test_t, format_has_to_be_advertised) {
+  EXPECT_FALSE(params.add(buffer(16), 0, 0, 4, 0, true));
+  EXPECT_EQ(code(params.check(2, 2, FORMAT, false)),
+            ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT);
+}
+
+TEST_F(params_test_t, dimensions_have_to_be_positive) {
+  EXPECT_FALSE(params.add(buffer(16), 0, 0, 4, 0, true));
+  EXPECT_EQ(code(params.check(0, 2, FORMAT, true)),
+            ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS);
+}
+
+TEST_F(params_test_t, plane_size_must_not_overflow) {
+  EXPECT_FALSE(params.add(buffer(16), 0, 16, UINT32_MAX / 2, 0, true));
+  EXPECT_EQ(code(params.check(1, 2, FORMAT, true)), ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS);
+}
+
+TEST_F(params_test_t, first_plane_has_to_fit) {
+  EXPECT_FALSE(params.add(buffer(64 * 4 * 63), 0, 0, 64 * 4, 0, true));
+  EXPECT_EQ(code(params.check(64, 64, FORMAT, true)),
+            ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS);
+}
+
+TEST_F(params_test_t, other_planes_may_be_subsampled) {
+  // NV12, the chroma plane is half the height of the luma plane
+  int fd = buffer(64 * 64 + 64 * 32);
+  EXPECT_FALSE(params.add(fd, 0, 0, 64, 0, true));
+  EXPECT_FALSE(params.add(fd, 1, 64 * 64, 64, 0, true));
+  EXPECT_FALSE(params.check(64, 64, FORMAT, true));
+
+  dmabuf_params_t beyond;
+  EXPECT_FALSE(beyond.add(fd, 0, 0, 64, 0, true));
+  EXPECT_FALSE(beyond.add(fd, 1, 64 * 64 + 64 * 32, 64, 0, true));
+  EXPECT_EQ(code(beyond.check(64, 64, FORMAT, true)),
+            ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS);
+}
@@ -0,0 +1,159 @@
+#include "barock/core/frame_scheduler.hpp"
+
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace barock;
+
+namespace {
+  /// A display that takes whatever it is asked, the flips land when the test says so
+  struct mock_kms_t : public kms_t {
+    bool                           capable  = true;
+    bool                           can_flip = true;
+    std::vector<bool>              vrr_requests;
+    std::vector<present_handler_t> flips;
+
+    bool
+    vrr(bool enable) override {
+      vrr_requests.push_back(enable);
+      return capable || !enable;
+    }
+
+    bool
+    repeat(present_handler_t on_presented) override {
+      if (!can_flip)
+        return false;
+      flips.push_back(std::move(on_presented));
+      return true;
+    }
+
+    /// Land the oldest pending flip at `usec'
+    void
+    land(uint64_t usec, bool discarded = false) {
+      auto on_presented = std::move(flips.front());
+      flips.erase(flips.begin());
+      on_presented({ .usec = usec, .discarded = discarded });
+    }
+  };
+
+  std::vector<uint64_t>
+  ramp(frame_scheduler_t &scheduler, mock_kms_t &kms) {
+    std::vector<uint64_t> intervals;
+    for (uint64_t timeout; (timeout = scheduler.timeout()) != 0;) {
+      intervals.push_back(timeout);
+      scheduler.idle();
+      EXPECT_TRUE(scheduler.take_repeat());
+      EXPECT_TRUE(scheduler.repeat(kms, [&](auto const &p) { scheduler.presented(p); }));
+      kms.land(1);
+    }
+    return intervals;
+  }
+}
+
+TEST(frame_scheduler, ramp_takes_the_same_steps_at_any_rate) {
+  for (float rate : { 48.f, 60.f, 144.f, 240.f }) {
+    mock_kms_t        kms;
+    frame_scheduler_t scheduler;
+    EXPECT_TRUE(scheduler.frame(kms, true, false, false, rate));
+
+    auto intervals = ramp(scheduler, kms);
+    ASSERT_EQ(intervals.size(), frame_scheduler_t::VRR_RAMP_STEPS) << rate << " Hz";
+    EXPECT_GT(intervals.front(), 1000000.f / rate);
+    for (size_t i = 1; i < intervals.size(); ++i)
+      EXPECT_GT(intervals[i], intervals[i - 1]);
+    EXPECT_NEAR(intervals.back(), frame_scheduler_t::VRR_RAMP_MAX_USEC, 2);
+  }
+}
+
+TEST(frame_scheduler, no_ramp_below_the_lowest_rate) {
+  mock_kms_t        kms;
+  frame_scheduler_t scheduler;
+  scheduler.frame(kms, true, false, false, 24.f);
+  EXPECT_EQ(scheduler.timeout(), 0u);
+}
+
+TEST(frame_scheduler, no_ramp_without_vrr) {
+  mock_kms_t        kms;
+  frame_scheduler_t scheduler;
+  EXPECT_FALSE(scheduler.frame(kms, false, false, false, 60.f));
+  EXPECT_EQ(scheduler.timeout(), 0u);
+
+  kms.capable = false;
+  EXPECT_FALSE(scheduler.frame(kms, true, false, false, 60.f));
+  EXPECT_EQ(scheduler.timeout(), 0u);
+  EXPECT_EQ(kms.vrr_requests, (std::vector<bool>{ false, true }));
+}
+
+TEST(frame_scheduler, fullscreen_sets_the_pace) {
+  mock_kms_t        kms;
+  frame_scheduler_t scheduler;
+  scheduler.presented({ .usec = 1000 });
+  EXPECT_TRUE(scheduler.frame(kms, true, true, false, 60.f));
+  EXPECT_EQ(scheduler.timeout(), 0u);
+  EXPECT_EQ(scheduler.start(2000, 60.f), 2000u);
+}
+
+TEST(frame_scheduler, failed_repeat_stops_the_ramp) {
+  mock_kms_t        kms;
+  frame_scheduler_t scheduler;
+  scheduler.frame(kms, true, false, false, 60.f);
+  ASSERT_NE(scheduler.timeout(), 0u);
+
+  kms.can_flip = false;
+  scheduler.idle();
+  EXPECT_FALSE(scheduler.repeat(kms, nullptr));
+  EXPECT_EQ(scheduler.timeout(), 0u);
+}
+
+TEST(frame_scheduler, starts_as_late_as_the_next_vblank_allows) {
+  mock_kms_t        kms;
+  frame_scheduler_t scheduler;
+  uint64_t          period = 1000000 / 50;
+
+  // Nothing to aim for before the first vblank
+  EXPECT_EQ(scheduler.start(500, 50.f), 500u);
+
+  scheduler.frame(kms, false, false, false, 50.f);
+  scheduler.painted(1000);
+  scheduler.presented({ .usec = 10000 });
+  scheduler.flipping();
+
+  uint64_t budget = 1000 + frame_scheduler_t::PAINT_MARGIN_USEC;
+  EXPECT_EQ(scheduler.start(10000, 50.f), 10000 + period - budget);
+
+  // The frame in flight takes the next vblank, we get the one after
+  scheduler.flipping();
+  EXPECT_EQ(scheduler.start(10000, 50.f), 10000 + 2 * period - budget);
+  scheduler.dropped();
+
+  // Too late for that one, aim for the one after
+  EXPECT_EQ(scheduler.start(10000 + period - budget + 1, 50.f), 10000 + 2 * period - budget);
+}
+
+TEST(frame_scheduler, discarded_flips_keep_the_last_vblank) {
+  mock_kms_t        kms;
+  frame_scheduler_t scheduler;
+  uint64_t          period = 1000000 / 50;
+  uint64_t          budget = frame_scheduler_t::PAINT_MARGIN_USEC;
+
+  scheduler.frame(kms, false, false, false, 50.f);
+  scheduler.presented({ .usec = 10000 });
+  scheduler.flipping();
+  scheduler.presented({ .usec = 99999, .discarded = true });
+  EXPECT_EQ(scheduler.start(10000, 50.f), 10000 + period - budget);
+}
+
+TEST(frame_scheduler, repeats_and_tearing_go_out_right_away) {
+  mock_kms_t        kms;
+  frame_scheduler_t scheduler;
+  scheduler.presented({ .usec = 10000 });
+
+  scheduler.frame(kms, false, false, true, 60.f);
+  EXPECT_EQ(scheduler.start(10000, 60.f), 10000u);
+
+  scheduler.frame(kms, true, false, false, 60.f);
+  scheduler.idle();
+  EXPECT_EQ(scheduler.start(10000, 60.f), 10000u);
+  EXPECT_TRUE(scheduler.take_repeat());
+  EXPECT_FALSE(scheduler.take_repeat());
+}
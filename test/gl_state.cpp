@@ -0,0 +1,233 @@
+#include "barock/render/gl_state.hpp"
+
+#include <EGL/egl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using namespace barock;
+
+namespace {
+  /// GL calls that reached the driver, in order
+  std::vector<std::string> calls;
+
+  /// What `eglGetCurrentContext' hands out
+  EGLContext context = EGL_NO_CONTEXT;
+
+  void
+  call(std::string name) {
+    calls.push_back(std::move(name));
+  }
+
+  struct gl_state_test_t : public ::testing::Test {
+    gl_state_t gl;
+
+    gl_state_test_t() {
+      calls.clear();
+    }
+  };
+}
+
+// The driver, as far as the tracker is concerned
+extern "C" {
+  EGLContext EGLAPIENTRY
+  eglGetCurrentContext() {
+    return context;
+  }
+
+  void GL_APIENTRY
+  glUseProgram(GLuint program) {
+    call("program " + std::to_string(program));
+  }
+
+  void GL_APIENTRY
+  glBindFramebuffer(GLenum, GLuint framebuffer) {
+    call("framebuffer " + std::to_string(framebuffer));
+  }
+
+  void GL_APIENTRY
+  glDeleteFramebuffers(GLsizei, const GLuint *) {
+    call("delete framebuffers");
+  }
+
+  void GL_APIENTRY
+  glActiveTexture(GLenum texture) {
+    call("unit " + std::to_string(texture - GL_TEXTURE0));
+  }
+
+  void GL_APIENTRY
+  glBindTexture(GLenum, GLuint texture) {
+    call("texture " + std::to_string(texture));
+  }
+
+  void GL_APIENTRY
+  glDeleteTextures(GLsizei, const GLuint *) {
+    call("delete textures");
+  }
+
+  void GL_APIENTRY
+  glBindBuffer(GLenum, GLuint buffer) {
+    call("buffer " + std::to_string(buffer));
+  }
+
+  void GL_APIENTRY
+  glDeleteBuffers(GLsizei, const GLuint *) {
+    call("delete buffers");
+  }
+
+  void GL_APIENTRY
+  glEnable(GLenum cap) {
+    call("enable " + std::to_string(cap));
+  }
+
+  void GL_APIENTRY
+  glDisable(GLenum cap) {
+    call("disable " + std::to_string(cap));
+  }
+
+  void GL_APIENTRY
+  glEnableVertexAttribArray(GLuint index) {
+    call("enable attribute " + std::to_string(index));
+  }
+
+  void GL_APIENTRY
+  glDisableVertexAttribArray(GLuint index) {
+    call("disable attribute " + std::to_string(index));
+  }
+
+  void GL_APIENTRY
+  glBlendFunc(GLenum, GLenum) {
+    call("blend func");
+  }
+
+  void GL_APIENTRY
+  glViewport(GLint, GLint, GLsizei, GLsizei) {
+    call("viewport");
+  }
+
+  void GL_APIENTRY
+  glScissor(GLint, GLint, GLsizei, GLsizei) {
+    call("scissor");
+  }
+}
+
+TEST_F(gl_state_test_t, redundant_calls_are_skipped) {
+  uint64_t saved = gl_state_t::saved();
+
+  gl.use_program(3);
+  gl.use_program(3);
+  gl.bind_framebuffer(1);
+  gl.bind_framebuffer(1);
+  gl.blend(true);
+  gl.blend(true);
+  gl.blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  gl.blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  gl.viewport(0, 0, 640, 480);
+  gl.viewport(0, 0, 640, 480);
+  gl.scissor_box(0, 0, 10, 10);
+  gl.scissor_box(0, 0, 10, 10);
+
+  EXPECT_EQ(calls.size(), 6u);
+  EXPECT_EQ(gl_state_t::saved() - saved, 6u);
+
+  // A change goes through
+  gl.use_program(4);
+  gl.viewport(0, 0, 800, 600);
+  EXPECT_EQ(calls.size(), 8u);
+  EXPECT_EQ(gl_state_t::saved() - saved, 6u);
+}
+
+TEST_F(gl_state_test_t, defaults_match_a_fresh_context) {
+  uint64_t saved = gl_state_t::saved();
+
+  // What GL starts out with needs no calls
+  gl.use_program(0);
+  gl.bind_framebuffer(0);
+  gl.blend(false);
+  gl.scissor(false);
+  gl.blend_func(GL_ONE, GL_ZERO);
+  gl.attributes(0);
+
+  EXPECT_TRUE(calls.empty());
+  EXPECT_EQ(gl_state_t::saved() - saved, 6u);
+}
+
+TEST_F(gl_state_test_t, texture_units_are_tracked_apart) {
+  gl.bind_texture(0, 5);
+  gl.bind_texture(1, 6);
+  gl.bind_texture(1, 6);
+  gl.bind_texture(0, 5);
+
+  EXPECT_EQ(calls, (std::vector<std::string>{ "texture 5", "unit 1", "texture 6", "unit 0" }));
+}
+
+TEST_F(gl_state_test_t, deleting_textures_forces_a_rebind) {
+  gl.bind_texture(0, 5);
+  GLuint texture = 5;
+  gl.delete_textures(1, &texture);
+  gl.bind_texture(0, 5);
+
+  EXPECT_EQ(calls, (std::vector<std::string>{ "texture 5", "delete textures", "texture 5" }));
+}
+
+TEST_F(gl_state_test_t, textures_deleted_elsewhere_force_a_rebind) {
+  gl_state_t other;
+  gl.bind_texture(0, 5);
+
+  // The name may have been handed out again since
+  GLuint texture = 7;
+  other.delete_textures(1, &texture);
+  gl.bind_texture(0, 5);
+
+  EXPECT_EQ(calls, (std::vector<std::string>{ "texture 5", "delete textures", "texture 5" }));
+}
+
+TEST_F(gl_state_test_t, deleting_the_bound_framebuffer_unbinds_it) {
+  gl.bind_framebuffer(2);
+  GLuint framebuffer = 2;
+  gl.delete_framebuffers(1, &framebuffer);
+  gl.bind_framebuffer(0);
+  gl.bind_framebuffer(2);
+
+  EXPECT_EQ(calls,
+            (std::vector<std::string>{ "framebuffer 2", "delete framebuffers", "framebuffer 2" }));
+}
+
+TEST_F(gl_state_test_t, deleting_a_bound_buffer_unbinds_it) {
+  gl.bind_buffer(GL_ARRAY_BUFFER, 4);
+  gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 4);
+  GLuint buffer = 4;
+  gl.delete_buffers(1, &buffer);
+  gl.bind_buffer(GL_ARRAY_BUFFER, 4);
+  gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 4);
+
+  EXPECT_EQ(calls.size(), 5u);
+}
+
+TEST_F(gl_state_test_t, attributes_toggle_only_what_changed) {
+  gl.attributes(0b011);
+  gl.attributes(0b110);
+  gl.attributes(0b110);
+
+  EXPECT_EQ(calls,
+            (std::vector<std::string>{ "enable attribute 0",
+                                       "enable attribute 1",
+                                       "disable attribute 0",
+                                       "enable attribute 2" }));
+}
+
+TEST_F(gl_state_test_t, a_new_context_starts_over) {
+  int first, second;
+
+  context = &first;
+  gl_state_t::current().use_program(3);
+  gl_state_t::current().use_program(3);
+  EXPECT_EQ(calls.size(), 1u);
+
+  // Same thread, another context, nothing of the old one is bound there
+  context = &second;
+  gl_state_t::current().use_program(3);
+  EXPECT_EQ(calls.size(), 2u);
+
+  context = EGL_NO_CONTEXT;
+}
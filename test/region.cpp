@@ -0,0 +1,98 @@
+#include "barock/core/region.hpp"
+
+#include <climits>
+#include <gtest/gtest.h>
+
+using namespace barock;
+
+TEST(region, union_is_the_bounding_box) {
+  EXPECT_EQ(region_t(0, 0, 10, 10) + region_t(20, 5, 10, 10), region_t(0, 0, 30, 15));
+  EXPECT_EQ(region_t(0, 0, 0, 0) + region_t(20, 5, 10, 10), region_t(20, 5, 10, 10));
+  EXPECT_EQ(region_t(20, 5, 10, 10) + region_t(0, 0, 0, 0), region_t(20, 5, 10, 10));
+}
+
+TEST(region, intersection) {
+  EXPECT_EQ(region_t(0, 0, 10, 10) - region_t(5, 5, 10, 10), region_t(5, 5, 5, 5));
+  EXPECT_TRUE((region_t(0, 0, 10, 10) - region_t(10, 0, 10, 10)).empty());
+  EXPECT_TRUE(region_t(0, 0, 10, 10).intersects(region_t(9, 9, 1, 1)));
+  EXPECT_FALSE(region_t(0, 0, 10, 10).intersects(region_t(10, 10, 1, 1)));
+}
+
+TEST(region, infinite_is_empty) {
+  EXPECT_TRUE(region_t::infinite.empty());
+  EXPECT_TRUE(region_t(0, 0, 0, 5).empty());
+  EXPECT_FALSE(region_t(0, 0, 1, 1).empty());
+}
+
+TEST(region, inner_union_never_claims_too_much) {
+  region_t a{ 0, 0, 10, 10 };
+
+  // Lined up, the union is a rectangle
+  EXPECT_EQ(a.inner_union({ 0, 10, 10, 5 }), region_t(0, 0, 10, 15));
+  EXPECT_EQ(a.inner_union({ 5, 0, 10, 10 }), region_t(0, 0, 15, 10));
+
+  // Contained
+  EXPECT_EQ(a.inner_union({ 2, 2, 2, 2 }), a);
+  EXPECT_EQ(region_t(2, 2, 2, 2).inner_union(a), a);
+
+  // An L shape, the bigger leg is all that is covered for sure
+  EXPECT_EQ(a.inner_union({ 10, 0, 20, 20 }), region_t(10, 0, 20, 20));
+  EXPECT_EQ(a.inner_union({ 10, 0, 2, 2 }), a);
+
+  // Apart, same thing
+  EXPECT_EQ(a.inner_union({ 50, 50, 1, 1 }), a);
+  EXPECT_EQ(region_t(0, 0, 0, 0).inner_union(a), a);
+}
+
+TEST(region, inner_subtract_keeps_the_largest_strip) {
+  region_t a{ 0, 0, 10, 10 };
+  EXPECT_EQ(a.inner_subtract({ 0, 0, 10, 3 }), region_t(0, 3, 10, 7));
+  EXPECT_EQ(a.inner_subtract({ 0, 0, 3, 10 }), region_t(3, 0, 7, 10));
+  EXPECT_EQ(a.inner_subtract({ 2, 2, 2, 2 }), region_t(0, 4, 10, 6));
+  EXPECT_EQ(a.inner_subtract({ 20, 20, 5, 5 }), a);
+  EXPECT_TRUE(a.inner_subtract({ -5, -5, 20, 20 }).empty());
+}
+
+TEST(region, outer_subtract_only_shrinks_for_full_cuts) {
+  region_t a{ 0, 0, 10, 10 };
+  EXPECT_EQ(a.outer_subtract({ 0, 0, 10, 3 }), region_t(0, 3, 10, 7));
+  EXPECT_EQ(a.outer_subtract({ 7, -5, 10, 20 }), region_t(0, 0, 7, 10));
+
+  // A hole still needs the bounds around it
+  EXPECT_EQ(a.outer_subtract({ 2, 2, 2, 2 }), a);
+
+  // A band through the middle leaves both sides
+  EXPECT_EQ(a.outer_subtract({ 0, 4, 10, 2 }), a);
+  EXPECT_TRUE(a.outer_subtract({ -5, -5, 20, 20 }).empty());
+}
+
+TEST(region, inner_never_exceeds_outer) {
+  wl_region_data_t region;
+  auto add = [&](region_t rect) {
+    region.outer = region.outer + rect;
+    region.inner = region.inner.inner_union(rect);
+  };
+  auto subtract = [&](region_t rect) {
+    region.outer = region.outer.outer_subtract(rect);
+    region.inner = region.inner.inner_subtract(rect);
+  };
+
+  add({ 0, 0, 100, 20 });
+  add({ 0, 20, 30, 80 });
+  subtract({ 10, 10, 5, 5 });
+  add({ 200, 200, 10, 10 });
+  subtract({ 0, 0, 210, 5 });
+
+  EXPECT_EQ(region.inner - region.outer, region.inner);
+  EXPECT_EQ(region.outer, region_t(0, 5, 210, 205));
+}
+
+TEST(region, clamped_keeps_the_far_edge_in_range) {
+  auto rect = region_t::clamped(INT32_MAX, INT32_MIN, INT32_MAX, -5);
+  EXPECT_EQ(rect.h, 0);
+  EXPECT_GT(rect.x, 0);
+  EXPECT_LT(rect.y, 0);
+  EXPECT_GT((int64_t)rect.x + rect.w, rect.x);
+  EXPECT_LE((int64_t)rect.x + rect.w, INT32_MAX);
+  EXPECT_EQ(region_t::clamped(1, 2, 3, 4), region_t(1, 2, 3, 4));
+}
@@ -0,0 +1,57 @@
+#include "barock/shell/throttle.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace barock;
+
+TEST(throttle, covered_by_an_opaque_window_above) {
+  std::vector<window_cover_t> windows{
+    { .bounds = { 0, 0, 100, 100 }, .opaque = { 0, 0, 100, 100 } },
+    { .bounds = { 10, 10, 50, 50 }, .opaque = { 10, 10, 50, 50 } },
+    { .bounds = { 90, 90, 50, 50 }, .opaque = { 90, 90, 50, 50 } },
+  };
+  EXPECT_FALSE(covered(windows, 0));
+  EXPECT_TRUE(covered(windows, 1));
+  EXPECT_FALSE(covered(windows, 2));
+}
+
+TEST(throttle, translucent_windows_cover_nothing) {
+  std::vector<window_cover_t> windows{
+    { .bounds = { 0, 0, 100, 100 }, .opaque = { 0, 0, 0, 0 } },
+    { .bounds = { 10, 10, 50, 50 }, .opaque = { 10, 10, 50, 50 } },
+  };
+  EXPECT_FALSE(covered(windows, 1));
+
+  // Only the opaque part of a window with a shadow counts
+  windows[0].opaque = { 20, 20, 60, 60 };
+  EXPECT_FALSE(covered(windows, 1));
+  windows[0].opaque = { 5, 5, 90, 90 };
+  EXPECT_TRUE(covered(windows, 1));
+}
+
+TEST(throttle, windows_below_cover_nothing) {
+  std::vector<window_cover_t> windows{
+    { .bounds = { 10, 10, 50, 50 }, .opaque = { 10, 10, 50, 50 } },
+    { .bounds = { 0, 0, 100, 100 }, .opaque = { 0, 0, 100, 100 } },
+  };
+  EXPECT_FALSE(covered(windows, 0));
+  EXPECT_FALSE(covered(windows, 1));
+}
+
+TEST(throttle, only_windows_no_output_shows) {
+  frame_throttle_t<int> throttle;
+  throttle.waiting(1, false);
+  throttle.waiting(2, true);
+  throttle.waiting(3, false);
+
+  // Hidden on one output, shown on the other
+  throttle.waiting(3, true);
+  throttle.waiting(1, false);
+
+  EXPECT_EQ(throttle.hidden(), std::vector<int>{ 1 });
+}
+
+TEST(throttle, nothing_waiting) {
+  frame_throttle_t<int> throttle;
+  EXPECT_TRUE(throttle.hidden().empty());
+}